@@ -2,11 +2,18 @@
 #include "parallelport.hpp"
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace A4s2600Registers;
 
 typedef std::chrono::duration<uint64_t, std::ratio<1,1000000> > UsDuration;
 
 A4s2600::A4s2600(ParallelPortBase &paralleport):
     parallelPort_(paralleport),
+    transactionDepth_(0),
+    motorControlAndChannelSelection_(0),
+    burstWrites_(BurstUnverified),
     wm8144_(*this)
 {
     readAsicRevision();
@@ -32,6 +39,10 @@ Wm8144::ColorChannels A4s2600::getWmChannel(Channel channel)
 
 void A4s2600::uploadRegisterSet(const unsigned char data[], size_t elementCount)
 {
+    //The register sets are init sequences (0x28 is written twice), so every write goes out as it is
+    begin();
+    queuePendingRegisters(transaction_);
+
     for(size_t i=0; i<elementCount; i+=2)
     {
         Register asicRegister;
@@ -39,17 +50,20 @@ void A4s2600::uploadRegisterSet(const unsigned char data[], size_t elementCount)
         asicRegister.address_ = data[i];
         asicRegister.value_ = data[i+1];
 
-        asicWriteRegister(asicRegister);
+        queueRegisterWrite(transaction_, asicRegister);
 
         for(unsigned int i=0; i<registerMap_.size(); ++i)
         {
             if(registerMap_[i].address_ == asicRegister.address_)
             {
                 registerMap_[i] = asicRegister;
+                hardwareRegisters_[i] = asicRegister.value_;
                 break;
             }
         }
     }
+
+    commit();
 }
 
 void A4s2600::uploadConfig()
@@ -126,6 +140,106 @@ void A4s2600::uploadConfig()
 }
 
 
+bool A4s2600::verifyBusTiming()
+{
+    for(unsigned i=0; i<32; ++i)
+    {
+        if(readFromChannel(0) != asicRevision_ || readFromChannel(1) != hwFeatures_)
+        {
+            return false;
+        }
+    }
+
+    //The address gaps are shared with writes, so a pattern and its inverse are written into the pixel gain memory and
+    //read back. The gain is uploaded again by the next calibration.
+    const unsigned address = getPixelGainAddress(Red);
+
+    for(unsigned pass=0; pass<2; ++pass)
+    {
+        const uint8_t invert = pass ? 0xFF : 0x00;
+
+        writeToChannel(0, address & 0xFF);
+        writeToChannel(1, (address >> 8) & 0xFF);
+
+        for(unsigned i=0; i<32; ++i)
+        {
+            writeToChannel(2, uint8_t(i * 0x3B + 0x5A) ^ invert);
+        }
+
+        writeToChannel(0, address & 0xFF);
+        writeToChannel(1, (address >> 8) & 0xFF);
+
+        for(unsigned i=0; i<32; ++i)
+        {
+            if(readFromChannel(3) != (uint8_t(i * 0x3B + 0x5A) ^ invert))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void A4s2600::autoTuneBusTiming()
+{
+    static const BusTiming::Delay readDelays[] =
+    {
+        BusTiming::AddressSetup,
+        BusTiming::AddressStrobe,
+        BusTiming::AddressHold,
+        BusTiming::ReadStrobe,
+        BusTiming::ReadHold
+    };
+
+    const unsigned resolution = 100; //ns
+    BusTiming timing = parallelPort_.getTiming();
+
+    for(BusTiming::Delay delay : readDelays)
+    {
+        const unsigned configured = timing.get(delay);
+        unsigned good = configured;
+        unsigned bad = 0;
+
+        //Maybe the syscall is slow enough on its own
+        timing.set(delay, 0);
+        parallelPort_.setTiming(timing);
+
+        if(verifyBusTiming())
+        {
+            good = 0;
+        }
+
+        while(good > bad + resolution)
+        {
+            unsigned candidate = (good + bad) / 2;
+
+            timing.set(delay, candidate);
+            parallelPort_.setTiming(timing);
+
+            if(verifyBusTiming())
+            {
+                good = candidate;
+            }else
+            {
+                bad = candidate;
+            }
+        }
+
+        //Keep some margin, but never go above what was configured
+        good = std::min(configured, good + good / 2 + resolution);
+        timing.set(delay, good);
+        parallelPort_.setTiming(timing);
+
+        std::cerr<<"Bus timing "<<BusTiming::getName(delay)<<": "<<std::dec<<good<<"ns (was "<<configured<<"ns)"<<std::endl;
+    }
+
+    if(!verifyBusTiming())
+    {
+        throw std::runtime_error("Bus timing auto tune failed");
+    }
+}
+
 void A4s2600::readAsicRevision()
 {
     asicRevision_ = readFromChannel(0);
@@ -133,331 +247,383 @@ void A4s2600::readAsicRevision()
 
 void A4s2600::writeToChannel(uint8_t channel, uint8_t value)
 {
+    if(transactionDepth_ > 0)
+    {
+        //The registers set up so far have to reach the ASIC in front of this write
+        queuePendingRegisters(transaction_);
+        queueChannelWrite(transaction_, channel, value);
+        return;
+    }
+
     //There is also a |0x18 << which seams to be used when reading back values using EPP mode ... could the 8 mean EPP? Or Tranfer?
     parallelPort_.writeByte(channel | 0x10, value);
 }
 
 uint8_t A4s2600::readFromChannel(uint8_t channel)
 {
+    flushTransaction();
+
     return parallelPort_.readByte(channel | 0x98);
 }
 
 void  A4s2600::readBufferFromChannel(uint8_t channel, uint8_t *buffer, size_t size)
 {
+    flushTransaction();
+
     parallelPort_.readString(channel | 0x98, (char*)buffer, size);
 }
 
-void A4s2600::asicWriteRegister(const Register &reg)
+void A4s2600::writeBufferToChannel(uint8_t channel, const uint8_t *buffer, size_t size)
 {
-    writeToChannel(0x6, reg.address_);
-    writeToChannel(0x5, reg.value_);
+    //Everything queued so far has to reach the ASIC in front of the burst
+    flushTransaction();
 
-    /*std::cout<<"Write\t  0x06 <- 0x"<<std::hex<<int(reg.address_)<<"\t0x05 <- 0x"<<int(reg.value_)<<std::endl;*/
+    parallelPort_.writeString(channel | 0x10, (const char*)buffer, size);
 }
 
-void A4s2600::enableChannel(enum Channel channel)
+void A4s2600::queueChannelWrite(BusProgram &program, uint8_t channel, uint8_t value)
 {
-    uint8_t mask = 0;
+    program.write(channel | 0x10, value);
+}
 
-    uint8_t value = registerMap_[26].value_;
+void A4s2600::queueRegisterWrite(BusProgram &program, const Register &reg)
+{
+    queueChannelWrite(program, 0x6, reg.address_);
+    queueChannelWrite(program, 0x5, reg.value_);
+}
 
-    switch (channel) {
-    case Red:   mask = 1<<2;    break; //011
-    case Green: mask = 1<<1;    break; //101
-    case Blue:  mask = 1;       break; //110
-    case AllChannels: mask = 7;  break; //111
+void A4s2600::writeRegister(unsigned index)
+{
+    if(transactionDepth_ > 0)
+    {
+        //Only remember the register, the value is taken when the transaction is committed
+        if(!registerPending_[index])
+        {
+            registerPending_[index] = true;
+            pendingRegisters_.push_back(index);
+        }
+
+        return;
     }
 
-    registerMap_[26].value_ = ~mask & 0x7;
-    asicWriteRegister(registerMap_[26]);
+    BusProgram program;
+
+    queueRegisterIfChanged(program, index);
+
+    if(!program.empty())
+    {
+        parallelPort_.execute(program);
+    }
 }
 
-void A4s2600::setUpperMemoryLimit(unsigned limit)
+void A4s2600::queueRegisterIfChanged(BusProgram &program, unsigned index)
 {
-    registerMap_[56].value_ = limit & 0xff;
-    registerMap_[57].value_ = (limit >> 8) & 0xff;
-    registerMap_[58].value_ = (limit >> 16) & 0xff;
+    if(hardwareRegisters_[index] != registerMap_[index].value_)
+    {
+        queueRegisterWrite(program, registerMap_[index]);
+        hardwareRegisters_[index] = registerMap_[index].value_;
+    }
+}
+
+void A4s2600::queuePendingRegisters(BusProgram &program)
+{
+    for(unsigned index : pendingRegisters_)
+    {
+        queueRegisterIfChanged(program, index);
+        registerPending_[index] = false;
+    }
 
-    asicWriteRegister(registerMap_[56]);
-    asicWriteRegister(registerMap_[57]);
-    asicWriteRegister(registerMap_[58]);
+    pendingRegisters_.clear();
 }
 
-void A4s2600::setLowerMemoryLimit(unsigned limit)
+void A4s2600::pulseRegister(unsigned index, uint8_t bits)
 {
-    registerMap_[59].value_ = limit & 0xff;
-    registerMap_[60].value_ = (limit >> 8) & 0xff;
-    registerMap_[61].value_ = (limit >> 16) & 0xff;
+    //A pulse is a side effect of the write itself, it always goes out and keeps its position in the sequence
+    begin();
+    queuePendingRegisters(transaction_);
+
+    registerMap_[index].value_ |= bits;
+    queueRegisterWrite(transaction_, registerMap_[index]);
+    registerMap_[index].value_ &= ~bits;
+    queueRegisterWrite(transaction_, registerMap_[index]);
 
-    asicWriteRegister(registerMap_[59]);
-    asicWriteRegister(registerMap_[60]);
-    asicWriteRegister(registerMap_[61]);
+    hardwareRegisters_[index] = registerMap_[index].value_;
+    commit();
 }
 
-void A4s2600::setAdcBitDepth(enum AdcBitDepth depth)
+void A4s2600::flushTransaction()
 {
-    depth_ = depth;
+    queuePendingRegisters(transaction_);
 
-    switch(depth)
+    if(!transaction_.empty())
     {
-    case TwelveBits: registerMap_[49].value_ &= 0x7f; break;
-    case TenBits: registerMap_[49].value_ |= 0x80; break;
+        parallelPort_.execute(transaction_);
+        transaction_.clear();
     }
-
-    asicWriteRegister(registerMap_[49]);
 }
 
-void A4s2600::setTextThreshold(unsigned threshold)
+void A4s2600::begin()
 {
-    registerMap_[13].value_ = threshold & 0xff;
-    asicWriteRegister(registerMap_[13]);
+    ++transactionDepth_;
 }
 
-void A4s2600::setLamp(bool enabled)
+void A4s2600::commit()
 {
-    if(enabled)
+    if(transactionDepth_ == 0)
     {
-        registerMap_[16].value_ &= ~0x2; //The lamp seams to be low active ....
-    }else
-    {
-        registerMap_[16].value_ |= 0x2;
+        throw std::runtime_error("Register commit without begin");
     }
 
-    asicWriteRegister(registerMap_[16]);
+    if(--transactionDepth_ == 0)
+    {
+        flushTransaction();
+    }
 }
 
-void A4s2600::setDataRequest(bool enabled)
+void A4s2600::invalidateRegisterCache()
 {
-    if(enabled)
-    {
-        registerMap_[16].value_ |= 0x04;
-    }else
+    wm8144_.invalidateRegisterCache();
+
+    for(int &value : hardwareRegisters_)
     {
-        registerMap_[16].value_ &= ~0x04;
+        if(value != NeverWritten)
+        {
+            value = UnknownValue;
+        }
     }
-
-    asicWriteRegister(registerMap_[16]);
 }
 
-void A4s2600::setDMA(bool enabled)
+void A4s2600::resyncRegisters()
 {
-    if(enabled)
-    {
-        registerMap_[16].value_ |= 0x08;
-    }else
+    //A transaction left open by an error is dropped, its registers are written below anyway
+    transactionDepth_ = 0;
+    transaction_.clear();
+
+    for(unsigned index : pendingRegisters_)
     {
-        registerMap_[16].value_ &= ~0x08;
+        registerPending_[index] = false;
     }
 
-    asicWriteRegister(registerMap_[16]);
-}
+    pendingRegisters_.clear();
 
-void A4s2600::setCCDMode(bool enabled)
-{
-    if(enabled)
+    //Only what went out to the ASIC is replayed, registers that were only set up in the map stay as they are
+    const std::vector<int> written = hardwareRegisters_;
+    Register setup;
+
+    invalidateRegisterCache();
+
+    //Like the register sets of uploadConfig the registers are written between 0x28 = 0 and 0x28 = 1
+    setup.address_ = 0x28;
+    setup.value_ = 0;
+
+    begin();
+    queueRegisterWrite(transaction_, setup);
+
+    for(unsigned index=0; index<registerMap_.size(); ++index)
     {
-        registerMap_[16].value_ |= 0x10;
-    }else
+        if(written[index] >= 0 && registerMap_[index].address_ != setup.address_)
+        {
+            Register asicRegister = registerMap_[index];
+
+            asicRegister.value_ = written[index];
+            queueRegisterWrite(transaction_, asicRegister);
+            hardwareRegisters_[index] = written[index];
+        }
+    }
+
+    setup.value_ = 1;
+    queueRegisterWrite(transaction_, setup);
+
+    for(unsigned index=0; index<registerMap_.size(); ++index)
     {
-        registerMap_[16].value_ &= ~0x10;
+        if(registerMap_[index].address_ == setup.address_)
+        {
+            hardwareRegisters_[index] = setup.value_;
+        }
     }
 
-    asicWriteRegister(registerMap_[16]);
+    commit();
 }
 
-void A4s2600::setEnableTextMode(bool enabled)
+void A4s2600::enableChannel(enum Channel channel)
 {
-    if(enabled)
-    {
-        registerMap_[16].value_ |= 0x40;
-    }else
-    {
-        registerMap_[16].value_ |= ~0x40;
+    uint8_t mask = 0;
+
+    switch (channel) {
+    case Red:   mask = 1<<2;    break; //011
+    case Green: mask = 1<<1;    break; //101
+    case Blue:  mask = 1;       break; //110
+    case AllChannels: mask = 7;  break; //111
     }
 
-    asicWriteRegister(registerMap_[16]);
+    update(ChannelDisable(~mask));
 }
 
+void A4s2600::setUpperMemoryLimit(unsigned limit)
+{
+    update(UpperMemoryLimit(limit));
+}
 
-void A4s2600::setCalibration(bool enabled)
+void A4s2600::setLowerMemoryLimit(unsigned limit)
 {
-    if(enabled)
-    {
-        registerMap_[16].value_ |= 0x80;
-    }else
-    {
-        registerMap_[16].value_ &= ~0x80;
-    }
+    update(LowerMemoryLimit(limit));
+}
+
+void A4s2600::setAdcBitDepth(enum AdcBitDepth depth)
+{
+    depth_ = depth;
 
-    asicWriteRegister(registerMap_[16]);
+    update(AdcTenBits(depth == TenBits));
+}
+
+void A4s2600::setTextThreshold(unsigned threshold)
+{
+    update(TextThreshold(threshold));
+}
+
+void A4s2600::setLamp(bool enabled)
+{
+    update(LampOff(!enabled));
+}
+
+void A4s2600::setDataRequest(bool enabled)
+{
+    update(DataRequest(enabled));
+}
+
+void A4s2600::setDMA(bool enabled)
+{
+    update(Dma(enabled));
+}
+
+void A4s2600::setCCDMode(bool enabled)
+{
+    update(CcdMode(enabled));
+}
+
+void A4s2600::setEnableTextMode(bool enabled)
+{
+    update(TextMode(enabled));
+}
+
+
+void A4s2600::setCalibration(bool enabled)
+{
+    update(Calibration(enabled));
 }
 
 void A4s2600::initializeAsicIndex()
 {
-    registerMap_.resize(64); //The Asic has 64 registers mapped at different addresses based on the revision
+    registerMap_.resize(RegisterCount); //The Asic has 64 registers mapped at different addresses based on the revision
+    hardwareRegisters_.assign(registerMap_.size(), NeverWritten);
+    registerPending_.assign(registerMap_.size(), false);
 
-    if(asicRevision_ == 0xa1)
+    for(unsigned int i=0; i<registerMap_.size(); i++)
     {
-        unsigned int ind=0;
-        for(unsigned int i=0; i<0x10; i++)
-        {
-            registerMap_[ind].address_ = 0x10+i;
-            registerMap_[ind].value_ = 0;
-            ind++;
-            registerMap_[ind].address_ = 0x20+i;
-            registerMap_[ind].value_ = 0;
-            ind++;
-            registerMap_[ind].address_ = 0x40+i;
-            registerMap_[ind].value_ = 0;
-            ind++;
-            registerMap_[ind].address_ = 0x80+i;
-            registerMap_[ind].value_ = 0;
-            ind++;
-        }
-    }else
-    {
-        for(unsigned int i=0; i<0x40; i++)
-        {
-            registerMap_[i].address_ = i;
-            registerMap_[i].value_ = 0;
-        }
+        registerMap_[i].address_ = registerAddress(asicRevision_, i);
+        registerMap_[i].value_ = 0;
     }
-
 }
 
 void A4s2600::sendSerialClock()
 {
-    registerMap_[49].value_ |= 0x40;
-    asicWriteRegister(registerMap_[49]);
-    registerMap_[49].value_ &= ~0x40;
-    asicWriteRegister(registerMap_[49]);
+    pulse<SerialClock>();
 }
 
 void A4s2600::selectAdFrequency(bool enable9Mhz)
 {
-    if(enable9Mhz)
-    {
-        registerMap_[49].value_ |= 0x02;
-    }else
-    {
-        registerMap_[49].value_ &= 0xfd;
-    }
-
-    asicWriteRegister(registerMap_[49]);
+    update(AdFrequency9Mhz(enable9Mhz));
 }
 
 void A4s2600::setLedMode(bool enable6Hz)
 {
-    if(enable6Hz)
-    {
-        registerMap_[12].value_ |= 0x03;
-    }else
-    {
-        registerMap_[12].value_ &= 0xFC;
-    }
-
-    asicWriteRegister(registerMap_[12]);
+    update(LedMode(enable6Hz ? 3 : 0));
 }
 
 void A4s2600::setBlackLevel(unsigned odd, unsigned even, uint8_t state)
 {
+    //The odd value is used for both, as in the original driver
     if (asicRevision_ == 0xa2 || asicRevision_ == 0xa4)
     {
-        registerMap_[51].value_ = (odd >> 8) & 0xff;
-        registerMap_[50].value_ = odd & 0xff;
-        registerMap_[53].value_ = (odd >> 8) & 0xff;
-        registerMap_[52].value_ = odd & 0xff;
-        registerMap_[63].value_ = state;
-
-        asicWriteRegister(registerMap_[51]);
-        asicWriteRegister(registerMap_[50]);
-        asicWriteRegister(registerMap_[53]);
-        asicWriteRegister(registerMap_[52]);
-        asicWriteRegister(registerMap_[63]);
-
+        update(BlackLevelOddA2(odd), BlackLevelEvenA2(odd), BlackLevelStateA2(state));
     }else
     {
-        registerMap_[34].value_ = (odd >> 8) & 0xff;
-        registerMap_[33].value_ = odd & 0xff;
-        registerMap_[20].value_ = (odd >> 8) & 0xff;
-        registerMap_[19].value_ = odd & 0xff;
-        registerMap_[21].value_ = state;
-
-        asicWriteRegister(registerMap_[34]);
-        asicWriteRegister(registerMap_[33]);
-        asicWriteRegister(registerMap_[20]);
-        asicWriteRegister(registerMap_[19]);
-        asicWriteRegister(registerMap_[21]);
+        update(BlackLevelOddA1(odd), BlackLevelEvenA1(odd), BlackLevelStateA1(state));
     }
 }
 
 void A4s2600::setByteCount(unsigned byteCount)
 {
-    registerMap_[22].value_ = byteCount & 0xff;
-    registerMap_[23].value_ = (byteCount >> 8) & 0xff;
-
-    asicWriteRegister(registerMap_[22]);
-    asicWriteRegister(registerMap_[23]);
+    update(ByteCount(byteCount));
 }
 
 void A4s2600::setExposureLevel(unsigned level)
 {
-    /* Red*/
-    registerMap_[6].value_ = level & 0xff;
-    registerMap_[7].value_ = (level >> 8) & 0xff;
-
-    /* Green */
-    registerMap_[8].value_ = level & 0xff;
-    registerMap_[9].value_ = (level >> 8) & 0xff;
-
-    /* Blue */
-    registerMap_[10].value_ = level & 0xff;
-    registerMap_[11].value_ = (level >> 8) & 0xff;
-
-    asicWriteRegister(registerMap_[6] );
-    asicWriteRegister(registerMap_[7] );
-    asicWriteRegister(registerMap_[8] );
-    asicWriteRegister(registerMap_[9] );
-    asicWriteRegister(registerMap_[10]);
-    asicWriteRegister(registerMap_[11]);
+    update(ExposureRed(level), ExposureGreen(level), ExposureBlue(level));
 }
 
 
 void A4s2600::resetFiFo()
 {
-    registerMap_[1].value_ |= 0x80;
-
-    asicWriteRegister(registerMap_[1]);
-
-    registerMap_[1].value_ &= ~0x80;
-
-    asicWriteRegister(registerMap_[1]);
+    pulse<FifoReset>();
 }
 
 void A4s2600::writeToWMRegister(unsigned reg, unsigned value)
 {
-    enableSerial(true);
+    //The WM8144 can not be read, so its bits only go out as a burst once a burst read back correctly
+    const bool burst = burstWritesWork();
+
+    //Serial enable and the address are queued in front of the 14 bits, which go out with the clock pulse
+    begin();
+
+    update(SerialEnable(true));
 
     unsigned cmd = (reg&0x2F)<<8 | (value & 0xFF);
+    uint8_t bits[14];
 
     writeToChannel(0x0,0x0);
     writeToChannel(0x1,0x34);
-    unsigned tmp = 0x2000;
 
-    do
+    for(unsigned i=0; i<sizeof(bits); ++i)
     {
-        if(tmp & cmd)
+        bits[i] = (cmd & (0x2000 >> i)) ? 1 : 0;
+    }
+
+    if(burst)
+    {
+        writeBufferToChannel(2, bits, sizeof(bits));
+    }else
+    {
+        for(uint8_t bit : bits)
         {
-            writeToChannel(2,1);
-        }else
+            writeToChannel(2, bit);
+        }
+    }
+
+    //Commit the value
+    sendSerialClock();
+
+    commit();
+}
+
+bool A4s2600::burstWritesWork()
+{
+    if(burstWrites_ == BurstUnverified)
+    {
+        //A short pattern in the pixel gain memory shows if the bytes of a burst are strobed as data
+        const unsigned address = getPixelGainAddress(Red);
+        uint8_t pattern[16];
+
+        for(unsigned i=0; i<sizeof(pattern); ++i)
         {
-            writeToChannel(2,0);
+            pattern[i] = uint8_t(i * 0x3B + 0x5A);
         }
 
-        tmp>>=1;
-    }while(tmp);
+        writePixelGain(address, pattern, sizeof(pattern), true);
+        burstWrites_ = pixelGainMatches(address, pattern, sizeof(pattern)) ? BurstVerified : BurstBroken;
+    }
 
-    sendSerialClock(); //Commit the value
+    return burstWrites_ == BurstVerified;
 }
 
 unsigned A4s2600::getStatus()
@@ -467,20 +633,12 @@ unsigned A4s2600::getStatus()
 
 void A4s2600::enableSerial(bool enable)
 {
-    if(enable)
-    {
-        registerMap_[49].value_ |= 0x20;
-    }else
-    {
-        registerMap_[49].value_ &= ~0x20;
-    }
-
-    asicWriteRegister(registerMap_[49]);
+    update(SerialEnable(enable));
 }
 
 unsigned A4s2600::getCurrentExposureLevel()
 {
-    return registerMap_[8].value_ | unsigned(registerMap_[9].value_) << 8;
+    return getField<ExposureGreen>();
 }
 
 unsigned A4s2600::readBlackLevel()
@@ -499,18 +657,13 @@ unsigned A4s2600::readBlackLevel()
 
 void A4s2600::setDigitalOffset(Channel channel, unsigned offset)
 {
-    unsigned index;
-
     switch(channel)
     {
-    case Red: index = 42; break;
-    case Green: index = 44; break;
-    case Blue: index = 46; break;
+    case Red: update(DigitalOffsetRed(offset)); break;
+    case Green: update(DigitalOffsetGreen(offset)); break;
+    case Blue: update(DigitalOffsetBlue(offset)); break;
     default: throw std::runtime_error("Not implemented");
     }
-
-    registerMap_[index].value_ = offset;
-    asicWriteRegister(registerMap_[index]);
 }
 
 void A4s2600::waitForClockLevel(bool high)
@@ -530,7 +683,7 @@ void A4s2600::waitForClockLevel(bool high)
 
 bool A4s2600::getClockLevel()
 {
-    return (getStatus() & 1) != 0;
+    return (getStatus() & StatusClock) != 0;
 }
 
 void A4s2600::waitForClockPulse()
@@ -556,15 +709,7 @@ void A4s2600::waitForClockChange()
 
 void A4s2600::enableSync(bool enable)
 {
-    if(enable)
-    {
-        registerMap_[5].value_ |= 0x20;
-    }else
-    {
-        registerMap_[5].value_ &= 0x20;
-    }
-
-    asicWriteRegister(registerMap_[5]);
+    update(Sync(enable));
 }
 
 void A4s2600::waitForChannelTransferedToFiFo(Channel channel)
@@ -602,12 +747,26 @@ void A4s2600::waitForChannelTransferedToFiFo(Channel channel)
 
 bool A4s2600::fifoAboveLowerLimit()
 {
-    return (getStatus() & 0x2) != 0;
+    return (getStatus() & StatusAboveLowerLimit) != 0;
+}
+
+void A4s2600::waitForFifoAboveLowerLimit()
+{
+    unsigned timeout = getCurrentExposureLevel() * 10 * 1000;
+    auto start  = std::chrono::steady_clock::now();
+
+    while(!fifoAboveLowerLimit())
+    {
+        if(std::chrono::duration_cast<UsDuration>(std::chrono::steady_clock::now() - start).count() > timeout)
+        {
+            throw std::runtime_error("Timeout while waiting for the FIFO to fill");
+        }
+    }
 }
 
 bool A4s2600::fifoAboveUpperLimit()
 {
-    return (getStatus() & 0x4) != 0;
+    return (getStatus() & StatusAboveUpperLimit) != 0;
 }
 
 void A4s2600::sendChannelData(Channel channel)
@@ -647,6 +806,31 @@ void A4s2600::stopChannelData(Channel channel)
     writeToChannel(4, motorControlAndChannelSelection_);
 }
 
+void A4s2600::startFreeRunning(Channel channel)
+{
+    unsigned value;
+
+    switch (channel)
+    {
+    case Red: value = 0x80; break;
+    case Green: value = 0x40; break;
+    case Blue: value = 0x20; break;
+    default: throw std::runtime_error("Not implemented");
+    }
+
+    update(Sync(true));
+
+    //Motor, speed, move and the channel reach the ASIC in one write, move and channel stay set until stopFreeRunning
+    motorControlAndChannelSelection_ |= value | 0x1C;
+    writeToChannel(4, motorControlAndChannelSelection_);
+}
+
+void A4s2600::stopFreeRunning()
+{
+    motorControlAndChannelSelection_ &= ~0xE4;
+    writeToChannel(4, motorControlAndChannelSelection_);
+}
+
 void A4s2600::aquireImageData(uint8_t *buffer, size_t bufferSize)
 {
     readBufferFromChannel(4, buffer, bufferSize);
@@ -717,25 +901,88 @@ void A4s2600::enableMove(bool enable)
 
 void A4s2600::setSpeedCounter(unsigned counter)
 {
-    registerMap_[25].value_ = (counter >> 8) & 0xFF;
-    registerMap_[24].value_ = counter & 0xFF;
+    update(SpeedCounter(counter));
+}
+
+void A4s2600::uploadPixelGain(Channel channel, const uint8_t *buffer, size_t bufferSize)
+{
+    if(bufferSize > pixelGainSize)
+    {
+        throw std::runtime_error("Pixel gain does not fit into the on chip memory");
+    }
+
+    if(channel == AllChannels)
+    {
+        uploadPixelGain(Red, buffer, bufferSize);
+        uploadPixelGain(Green, buffer, bufferSize);
+        uploadPixelGain(Blue, buffer, bufferSize);
+        return;
+    }
+
+    const unsigned address = getPixelGainAddress(channel);
+
+    //The burst is checked with the read back, once it failed every byte is an addressed write
+    if(burstWrites_ != BurstBroken)
+    {
+        writePixelGain(address, buffer, bufferSize, true);
+
+        if(pixelGainMatches(address, buffer, bufferSize))
+        {
+            burstWrites_ = BurstVerified;
+            return;
+        }
+
+        std::cerr<<"The pixel gain burst did not read back, writing it byte by byte"<<std::endl;
+        burstWrites_ = BurstBroken;
+    }
 
-    asicWriteRegister(registerMap_[25]);
-    asicWriteRegister(registerMap_[24]);
+    writePixelGain(address, buffer, bufferSize, false);
+
+    if(!pixelGainMatches(address, buffer, bufferSize))
+    {
+        throw std::runtime_error("Pixel gain verification failed");
+    }
 }
 
-void A4s2600::uploadPixelGain(Channel channel, uint8_t *buffer, size_t bufferSize)
+void A4s2600::writePixelGain(unsigned address, const uint8_t *buffer, size_t bufferSize, bool burst)
 {
-    writeToChannel(0,0);
-    switch(channel)
+    //The address is set once, the ASIC increments it with every byte written
+    begin();
+    writeToChannel(0, address & 0xFF);
+    writeToChannel(1, (address >> 8) & 0xFF);
+
+    if(burst)
     {
-    case Red:writeToChannel(1,0x38); break;
-    case Green: writeToChannel(1,0x50); break;
-    case Blue: writeToChannel(1,0x68); break;
+        writeBufferToChannel(2, buffer, bufferSize);
+    }else
+    {
+        for(size_t i=0; i<bufferSize; ++i)
+        {
+            writeToChannel(2, buffer[i]);
+        }
     }
 
-    for(unsigned int i=0; i<bufferSize; ++i)
+    commit();
+}
+
+bool A4s2600::pixelGainMatches(unsigned address, const uint8_t *buffer, size_t bufferSize)
+{
+    std::vector<uint8_t> readBack(bufferSize);
+
+    writeToChannel(0, address & 0xFF);
+    writeToChannel(1, (address >> 8) & 0xFF);
+    readBufferFromChannel(3, &readBack[0], readBack.size());
+
+    return std::equal(readBack.begin(), readBack.end(), buffer);
+}
+
+unsigned A4s2600::getPixelGainAddress(Channel channel)
+{
+    switch(channel)
     {
-        writeToChannel(2,buffer[i]);
+    case Red: return 0x3800;
+    case Green: return 0x5000;
+    case Blue: return 0x6800;
+    default: throw std::runtime_error("Not implemented");
     }
 }
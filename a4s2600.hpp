@@ -5,10 +5,10 @@
 #include <stdint.h>
 #include <vector>
 
+#include "parallelport.hpp"
 #include "register.hpp"
 #include "wm8144.hpp"
 
-class ParallelPortBase;
 
 
 class A4s2600
@@ -43,7 +43,8 @@ public:
 
     enum
     {
-        lastOnChipMemoryAddress = 0x1FFFF //129kbyte on chip memory
+        lastOnChipMemoryAddress = 0x1FFFF, //129kbyte on chip memory
+        pixelGainSize = 0x1800 //Bytes of the pixel gain of one channel
     };
 
     enum MotorDirection
@@ -54,6 +55,62 @@ public:
 
     A4s2600(ParallelPortBase &paralleport);
 
+    /**
+     * @brief begin starts a group of register changes
+     *
+     * The setters only update the register map until the matching commit(), which uploads the registers
+     * that differ from what the ASIC already has in a single bus program. Channel writes in between are
+     * queued behind the registers changed so far, a read executes everything queued up to it.
+     * begin()/commit() can be nested, the upload happens at the outermost commit().
+     */
+    void begin();
+    void commit();
+
+    /**
+     * @brief update sets fields of the registers (see register.hpp)
+     *
+     * All fields are applied to the register map first, so fields sharing a register result in a single
+     * write of that register, registers that do not change are not written at all.
+     */
+    template<typename... Fields>
+    void update(Fields... fields)
+    {
+        static_assert(!A4s2600Registers::Overlapping<Fields...>::value, "The fields of an update must not overlap");
+
+        begin();
+        applyFields(fields...);
+        commit();
+    }
+
+    /**
+     * @brief getField returns the value of a field as it is in the register map
+     */
+    template<typename Field>
+    unsigned getField() const
+    {
+        unsigned value = 0;
+
+        for(unsigned i=0; i<Field::bytes; ++i)
+        {
+            value |= unsigned(registerMap_[Field::index + i].value_ & Field::mask) << (8 * i);
+        }
+
+        return value >> Field::shift;
+    }
+
+    /**
+     * @brief invalidateRegisterCache forgets what the ASIC and WM8144 registers contain, e.g. after the scanner was reset.
+     * Every register that is set afterwards is written again, even if the value did not change.
+     */
+    void invalidateRegisterCache();
+
+    /**
+     * @brief resyncRegisters writes the last value of every register the driver has written so far again, e.g. after an
+     * error left the ASIC in an unknown state. They go out between 0x28 = 0 and 0x28 = 1 like the register sets of the
+     * initial setup. A transaction that is still open is dropped.
+     */
+    void resyncRegisters();
+
     void setUpperMemoryLimit(unsigned limit);
     void setLowerMemoryLimit(unsigned limit);
     void setAdcBitDepth(AdcBitDepth depth);
@@ -83,12 +140,18 @@ public:
     void setBlackLevel(unsigned odd, unsigned even, uint8_t state);
 
     unsigned getAsicRevision() { return asicRevision_; }
+    unsigned getHardwareFeatures() { return hwFeatures_; }
 
     unsigned readBlackLevel();
 
     void setDigitalOffset(Channel channel, unsigned offset);
 
     void enableSerial(bool enable);
+
+    /**
+     * @brief writeToWMRegister shifts a register write into the WM8144. The 14 bits go out as a single burst once a burst
+     * was verified with a read back, otherwise every bit is an addressed write.
+     */
     void writeToWMRegister(unsigned reg, unsigned value);
 
     /**
@@ -105,6 +168,13 @@ public:
 
     void setExposureLevel(unsigned level);
 
+    enum StatusBits
+    {
+        StatusClock = 0x01,           ///< Level of the exposure clock
+        StatusAboveLowerLimit = 0x02, ///< The FIFO holds more than the lower memory limit
+        StatusAboveUpperLimit = 0x04  ///< The FIFO holds more than the upper memory limit
+    };
+
     unsigned getStatus(); //Return the raw status ...
 
     unsigned getCurrentExposureLevel(); //Return the current exposure level
@@ -118,6 +188,11 @@ public:
 
     void waitForChannelTransferedToFiFo(Channel channel);
     bool fifoAboveLowerLimit();
+
+    /**
+     * @brief waitForFifoAboveLowerLimit waits until the FIFO holds more bytes than the lower memory limit
+     */
+    void waitForFifoAboveLowerLimit();
     bool fifoAboveUpperLimit();
 
     void sendChannelData(Channel channel);
@@ -132,6 +207,15 @@ public:
     void setSpeedCounter(unsigned counter);
     void enableSync(bool enable);
 
+    /**
+     * @brief startFreeRunning lets the ASIC expose the channel and step the motor on every rising clock edge by itself
+     *
+     * Sync and speed with the motor, the move and the channel bit held instead of pulsed are what the driver assumes to select
+     * this, it is not verified on a scanner yet. stopFreeRunning releases the move and the channel bit again.
+     */
+    void startFreeRunning(Channel channel);
+    void stopFreeRunning();
+
 
     Wm8144 &getWm8144() { return wm8144_; }
 
@@ -139,26 +223,110 @@ public:
 
     Wm8144::ColorChannels getWmChannel(Channel channel);
 
-    void uploadPixelGain(Channel channel, uint8_t *buffer, size_t bufferSize);
+    /**
+     * @brief uploadPixelGain writes the gain of every pixel into the on chip memory and reads it back
+     *
+     * The data goes out as a single burst per channel and is checked with the read back. If that does not match, the burst
+     * is not used any more and every byte is an addressed write. AllChannels uploads the same gain to all three.
+     * Throws if the read back of the addressed writes does not match either.
+     */
+    void uploadPixelGain(Channel channel, const uint8_t *buffer, size_t bufferSize);
+
+    /**
+     * @brief autoTuneBusTiming searches the smallest gaps of a read cycle for which verifyBusTiming() still succeeds.
+     *
+     * The data gaps of writes are left alone. The address gaps are shared with writes, verifyBusTiming() checks them with writes too.
+     */
+    void autoTuneBusTiming();
+
+    /**
+     * @brief verifyBusTiming checks the current bus timing by reading the revision and hardware feature registers and by
+     * writing a pattern into the pixel gain memory and reading it back. Overwrites the pixel gain of the red channel.
+     */
+    bool verifyBusTiming();
 
 private:
+    enum
+    {
+        UnknownValue = -1, ///< Written before, but the content of the ASIC register is unknown
+        NeverWritten = -2
+    };
+
+    enum BurstWrites
+    {
+        BurstUnverified,
+        BurstVerified, ///< A burst read back correctly
+        BurstBroken    ///< A burst did not read back, addressed writes are used instead
+    };
+
     ParallelPortBase &parallelPort_;
     std::vector<Register> registerMap_;
+    std::vector<int> hardwareRegisters_;  ///< Last value written to each register
+    std::vector<bool> registerPending_;
+    std::vector<unsigned> pendingRegisters_; ///< Registers changed in the open transaction, in order
+    unsigned transactionDepth_;
+    BusProgram transaction_;
 
     AdcBitDepth depth_;
     unsigned int asicRevision_;
     unsigned hwFeatures_;
     unsigned motorControlAndChannelSelection_;
+    BurstWrites burstWrites_;
 
     bool hasWM8142_;
 
 
     Wm8144 wm8144_;
 
-    void asicWriteRegister(const Register &reg);
+    void applyFields() {}
+
+    template<typename Field, typename... Fields>
+    void applyFields(Field field, Fields... fields)
+    {
+        bool changed = false;
+
+        for(unsigned j=0; j<Field::bytes; ++j)
+        {
+            const unsigned i = Field::highFirst ? Field::bytes - 1 - j : j;
+
+            registerMap_[Field::index + i].value_ = (registerMap_[Field::index + i].value_ & ~Field::mask) | field.byte(i);
+
+            //The low byte latches a high first value, so it goes out after every change of the other bytes
+            if(Field::highFirst && i == 0 && changed)
+            {
+                hardwareRegisters_[Field::index] = UnknownValue;
+            }
+
+            changed = changed || hardwareRegisters_[Field::index + i] != registerMap_[Field::index + i].value_;
+            writeRegister(Field::index + i);
+        }
+
+        applyFields(fields...);
+    }
+
+    template<typename Field>
+    void pulse() { pulseRegister(Field::index, Field::mask); }
+
+    void writeRegister(unsigned index);
+    void pulseRegister(unsigned index, uint8_t bits);
+    void queueRegisterIfChanged(BusProgram &program, unsigned index);
+    void queuePendingRegisters(BusProgram &program);
+    void flushTransaction();
+    void queueRegisterWrite(BusProgram &program, const Register &reg);
+    void queueChannelWrite(BusProgram &program, uint8_t channel, uint8_t value);
     void writeToChannel(uint8_t channel, uint8_t value);
     uint8_t readFromChannel(uint8_t channel);
     void readBufferFromChannel(uint8_t channel, uint8_t *, size_t);
+    void writeBufferToChannel(uint8_t channel, const uint8_t *, size_t);
+    unsigned getPixelGainAddress(Channel channel);
+    void writePixelGain(unsigned address, const uint8_t *buffer, size_t bufferSize, bool burst);
+    bool pixelGainMatches(unsigned address, const uint8_t *buffer, size_t bufferSize);
+
+    /**
+     * @brief burstWritesWork tells if a burst reached the ASIC correctly. Until a burst was checked, a short pattern is
+     * written into the pixel gain memory of the red channel and read back, the gain is uploaded again by the next calibration.
+     */
+    bool burstWritesWork();
 
     void readAsicRevision();
     void initializeAsicIndex();
@@ -0,0 +1,603 @@
+#include "a4s2600simulator.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+static const uint8_t scannerSequence[] = {0x15,0x95,0x35,0xB5,0x55,0xD5,0x75,0xF5,0x1,0x81};
+static const uint8_t printerSequence[] = {0x15,0x95,0x35,0xB5,0x55,0xD5,0x75,0xF5,0x0,0x80};
+
+A4s2600Simulator::A4s2600Simulator(unsigned asicRevision, unsigned hwFeatures):
+    asicRevision_(asicRevision),
+    hwFeatures_(hwFeatures),
+    now_(0),
+    addressedAccessCost_(30000),
+    streamedByteCost_(6000),
+    lastAccessWasStatusPoll_(false),
+    lastStatus_(0),
+    identicalPolls_(0),
+    registerAddress_(0),
+    serialShiftRegister_(0),
+    memory_(0x10000, 0),
+    memoryAddress_(0),
+    fifo_(FifoSize, 0),
+    fifoRead_(0),
+    fifoLevel_(0),
+    motorControl_(0),
+    position_(600),
+    dataLines_(0),
+    scannerSelected_(false),
+    lineNumber_(0)
+{
+    memset(registers_, 0, sizeof(registers_));
+    memset(wmRegisters_, 0, sizeof(wmRegisters_));
+    resetStatistics();
+}
+
+void A4s2600Simulator::setBusCost(uint64_t addressedAccess, uint64_t streamedByte)
+{
+    addressedAccessCost_ = addressedAccess;
+    streamedByteCost_ = streamedByte;
+}
+
+void A4s2600Simulator::resetStatistics()
+{
+    memset(&statistics_, 0, sizeof(statistics_));
+}
+
+/* ------------------------------------------------------------------------------------------*/
+
+void A4s2600Simulator::writeByte(char address, char byte)
+{
+    const uint8_t addr = address;
+
+    lastAccessWasStatusPoll_ = false;
+    advance(addressedAccessCost_);
+    ++statistics_.addressedWrites_;
+
+    if(scannerSelected_ && (addr & 0xF8) == 0x10)
+    {
+        writeChannel(addr & 0x7, byte);
+    }
+
+    logWrite(address, byte);
+}
+
+char A4s2600Simulator::readByte(char address)
+{
+    const uint8_t addr = address;
+    char result = 0xFF;
+
+    if(scannerSelected_ && (addr & 0xF8) == 0x98)
+    {
+        const bool statusPoll = (addr & 0x7) == 6;
+
+        advance(addressedAccessCost_);
+
+        //Once a poll loop is recognised, polling the same status again would just repeat until the next event
+        if(statusPoll && lastAccessWasStatusPoll_ && getStatus() == lastStatus_)
+        {
+            if(++identicalPolls_ >= 2)
+            {
+                fastForward();
+            }
+        }else
+        {
+            identicalPolls_ = 0;
+        }
+
+        lastAccessWasStatusPoll_ = statusPoll;
+        result = readChannel(addr & 0x7);
+
+        if(uint8_t(result) != lastStatus_)
+        {
+            identicalPolls_ = 0;
+        }
+
+        lastStatus_ = result;
+    }else
+    {
+        lastAccessWasStatusPoll_ = false;
+        advance(addressedAccessCost_);
+    }
+
+    ++statistics_.addressedReads_;
+    logRead(address, result);
+
+    return result;
+}
+
+void A4s2600Simulator::readString(char address, char * const buffer, size_t bufferSize)
+{
+    const uint8_t addr = address;
+
+    lastAccessWasStatusPoll_ = false;
+    advance(addressedAccessCost_);
+    ++statistics_.addressedReads_;
+
+    for(size_t i=0; i<bufferSize; ++i)
+    {
+        advance(streamedByteCost_);
+        buffer[i] = (scannerSelected_ && (addr & 0xF8) == 0x98) ? readChannel(addr & 0x7) : 0xFF;
+        logRead(address, buffer[i]);
+    }
+
+    statistics_.streamedBytes_ += bufferSize;
+}
+
+void A4s2600Simulator::writeString(char address, char const*const buffer, size_t bufferSize)
+{
+    const uint8_t addr = address;
+
+    lastAccessWasStatusPoll_ = false;
+    advance(addressedAccessCost_);
+    ++statistics_.addressedWrites_;
+
+    for(size_t i=0; i<bufferSize; ++i)
+    {
+        advance(streamedByteCost_);
+
+        if(scannerSelected_ && (addr & 0xF8) == 0x10)
+        {
+            writeChannel(addr & 0x7, buffer[i]);
+        }
+
+        logWrite(address, buffer[i]);
+    }
+
+    statistics_.streamedBytes_ += bufferSize;
+}
+
+void A4s2600Simulator::writeByte(char byte)
+{
+    //Plain data line writes are only used for the printer/scanner switch sequence
+    dataLines_ = byte;
+
+    selectSequence_.push_back(dataLines_);
+    if(selectSequence_.size() > sizeof(scannerSequence))
+    {
+        selectSequence_.erase(selectSequence_.begin());
+    }
+
+    if(selectSequence_.size() == sizeof(scannerSequence))
+    {
+        if(std::equal(selectSequence_.begin(), selectSequence_.end(), scannerSequence))
+        {
+            scannerSelected_ = true;
+        }else if(std::equal(selectSequence_.begin(), selectSequence_.end(), printerSequence))
+        {
+            scannerSelected_ = false;
+        }
+    }
+}
+
+char A4s2600Simulator::readByte()
+{
+    return dataLines_;
+}
+
+void A4s2600Simulator::readString(char * const buffer, size_t bufferSize)
+{
+    for(size_t i=0; i<bufferSize; ++i)
+    {
+        buffer[i] = readByte();
+    }
+}
+
+void A4s2600Simulator::writeString(char const*const buffer, size_t bufferSize)
+{
+    for(size_t i=0; i<bufferSize; ++i)
+    {
+        writeByte(buffer[i]);
+    }
+}
+
+/* ------------------------------------------------------------------------------------------*/
+
+void A4s2600Simulator::advance(uint64_t ns)
+{
+    advanceTo(now_ + ns);
+}
+
+void A4s2600Simulator::advanceTo(uint64_t time)
+{
+    const uint64_t halfPeriod = getHalfClockPeriod();
+
+    //While the ASIC runs on its own, every rising clock edge in between starts a line
+    if(isFreeRunning() && halfPeriod)
+    {
+        uint64_t edge = (now_ / halfPeriod + 1) * halfPeriod;
+
+        if(!((edge / halfPeriod) & 1))
+        {
+            edge += halfPeriod;
+        }
+
+        for(; edge <= time && isFreeRunning(); edge += 2 * halfPeriod)
+        {
+            now_ = edge;
+            completeTransfers();
+            freeRunningLine();
+        }
+    }
+
+    now_ = std::max(now_, time);
+    completeTransfers();
+}
+
+bool A4s2600Simulator::isFreeRunning() const
+{
+    //Sync and speed with the move and a channel bit held instead of pulsed, see A4s2600::startFreeRunning
+    return (getRegisterValue(5) & 0x20) && (motorControl_ & 0x0C) == 0x0C && (motorControl_ & 0xE0);
+}
+
+void A4s2600Simulator::freeRunningLine()
+{
+    //Nothing holds the line back, a FIFO the host does not drain in time overflows
+    for(unsigned channel=0; channel<3; ++channel)
+    {
+        if(motorControl_ & (0x80 >> channel))
+        {
+            startTransfer(channel);
+        }
+    }
+
+    if(motorControl_ & 0x10)
+    {
+        step();
+    }
+}
+
+void A4s2600Simulator::fastForward()
+{
+    //Somebody is busy waiting for the status to change, so jump to the next point where it does
+    const uint64_t halfPeriod = getHalfClockPeriod();
+    uint64_t next = now_;
+
+    if(halfPeriod)
+    {
+        next = (now_ / halfPeriod + 1) * halfPeriod;
+    }
+
+    if(!pendingTransfers_.empty() && (next == now_ || pendingTransfers_.front().finished_ < next))
+    {
+        next = std::max(now_, pendingTransfers_.front().finished_);
+    }
+
+    advanceTo(next);
+}
+
+void A4s2600Simulator::completeTransfers()
+{
+    while(!pendingTransfers_.empty() && pendingTransfers_.front().finished_ <= now_)
+    {
+        captureLine(pendingTransfers_.front());
+        pendingTransfers_.pop_front();
+    }
+}
+
+void A4s2600Simulator::captureLine(const Transfer &transfer)
+{
+    const unsigned byteCount = getByteCount();
+
+    ++lineNumber_;
+    ++statistics_.linesCaptured_;
+
+    for(unsigned i=0; i<byteCount; ++i)
+    {
+        if(fifoLevel_ == FifoSize)
+        {
+            ++statistics_.fifoOverflows_;
+            return;
+        }
+
+        fifo_[(fifoRead_ + fifoLevel_) % FifoSize] = getPixel(transfer.channel_, i, transfer.position_);
+        ++fifoLevel_;
+    }
+}
+
+uint8_t A4s2600Simulator::readFifo()
+{
+    if(fifoLevel_ == 0)
+    {
+        if(pendingTransfers_.empty())
+        {
+            ++statistics_.fifoUnderruns_;
+            return 0;
+        }
+
+        //The port waits until the ASIC has data
+        advanceTo(pendingTransfers_.front().finished_);
+    }
+
+    uint8_t value = fifo_[fifoRead_];
+
+    fifoRead_ = (fifoRead_ + 1) % FifoSize;
+    --fifoLevel_;
+
+    return value;
+}
+
+/* ------------------------------------------------------------------------------------------*/
+
+void A4s2600Simulator::writeChannel(unsigned channel, uint8_t value)
+{
+    switch(channel)
+    {
+    case 0: memoryAddress_ = (memoryAddress_ & 0xFF00) | value; break;
+    case 1: memoryAddress_ = (memoryAddress_ & 0x00FF) | (unsigned(value) << 8); break;
+    case 2:
+        if((memoryAddress_ >> 8) == 0x34)
+        {
+            //This is the serial port to the WM8144, one bit per write
+            serialShiftRegister_ = ((serialShiftRegister_ << 1) | (value & 1)) & 0x3FFF;
+        }else
+        {
+            memory_[memoryAddress_] = value;
+            memoryAddress_ = (memoryAddress_ + 1) & 0xFFFF;
+        }
+        break;
+    case 4: writeMotorControl(value); break;
+    case 5: writeRegister(registerAddress_, value); break;
+    case 6: registerAddress_ = value; break;
+    default: break;
+    }
+}
+
+uint8_t A4s2600Simulator::readChannel(unsigned channel)
+{
+    switch(channel)
+    {
+    case 0: return asicRevision_;
+    case 1: return hwFeatures_;
+    case 3:
+    {
+        uint8_t value;
+
+        if((memoryAddress_ >> 8) == 0xC0)
+        {
+            //The black level of the masked pixels
+            value = getPixel(1, memoryAddress_ & 0x0F, position_);
+        }else
+        {
+            value = memory_[memoryAddress_];
+        }
+
+        memoryAddress_ = (memoryAddress_ + 1) & 0xFFFF;
+        return value;
+    }
+    case 4: return readFifo();
+    case 6: ++statistics_.statusPolls_; return getStatus();
+    case 7: return position_ < HomeSensorEnd ? 1<<6 : 0;
+    default: return 0;
+    }
+}
+
+void A4s2600Simulator::writeRegister(unsigned address, uint8_t value)
+{
+    const uint8_t previous = registers_[address & 0xFF];
+
+    registers_[address & 0xFF] = value;
+    ++statistics_.registerWrites_;
+
+    if(address == getRegisterAddress(1) && (value & 0x80))
+    {
+        fifoRead_ = 0;
+        fifoLevel_ = 0;
+        pendingTransfers_.clear();
+    }
+
+    if(address == getRegisterAddress(49) && (value & 0x40) && !(previous & 0x40))
+    {
+        latchSerialRegister();
+    }
+}
+
+void A4s2600Simulator::latchSerialRegister()
+{
+    const unsigned reg = (serialShiftRegister_ >> 8) & 0x3F;
+    const uint8_t value = serialShiftRegister_ & 0xFF;
+
+    ++statistics_.wmWrites_;
+
+    //The per channel registers have a fourth address that writes all three channels
+    if(reg >= 0x20 && (reg & 0x3) == 0x3)
+    {
+        wmRegisters_[reg & ~0x3] = value;
+        wmRegisters_[(reg & ~0x3) | 1] = value;
+        wmRegisters_[(reg & ~0x3) | 2] = value;
+    }
+
+    wmRegisters_[reg] = value;
+}
+
+void A4s2600Simulator::writeMotorControl(uint8_t value)
+{
+    uint8_t rising = value & ~motorControl_;
+
+    motorControl_ = value;
+
+    //A free running ASIC starts the line on the next clock edge instead
+    if(isFreeRunning())
+    {
+        rising &= ~0xE4;
+    }
+
+    if(rising & 0x80)
+    {
+        startTransfer(0);
+    }
+
+    if(rising & 0x40)
+    {
+        startTransfer(1);
+    }
+
+    if(rising & 0x20)
+    {
+        startTransfer(2);
+    }
+
+    if((rising & 0x04) && (value & 0x10))
+    {
+        step();
+    }
+}
+
+void A4s2600Simulator::step()
+{
+    const double distance = 32500.0 / std::max(1u, getSpeedCounter());
+
+    position_ += (motorControl_ & 0x02) ? -distance : distance;
+    position_ = std::max(position_, -20.0); //The carriage hits the end of the housing
+
+    ++statistics_.motorSteps_;
+}
+
+void A4s2600Simulator::startTransfer(unsigned channel)
+{
+    //Reading out the CCD takes one AD clock per pixel, either 6 or 9Mhz
+    const uint64_t adClock = (getRegisterValue(49) & 0x02) ? 9 : 6;
+    Transfer transfer;
+
+    transfer.channel_ = channel;
+    transfer.position_ = position_;
+    transfer.finished_ = std::max(now_, pendingTransfers_.empty() ? 0 : pendingTransfers_.back().finished_);
+    transfer.finished_ += getByteCount() * 1000 / adClock;
+
+    pendingTransfers_.push_back(transfer);
+}
+
+/* ------------------------------------------------------------------------------------------*/
+
+unsigned A4s2600Simulator::getRegisterAddress(unsigned index) const
+{
+    //Same mapping as A4s2600::initializeAsicIndex
+    if(asicRevision_ == 0xa1)
+    {
+        return (0x10 << (index % 4)) + index / 4;
+    }
+
+    return index;
+}
+
+unsigned A4s2600Simulator::getExposure() const
+{
+    return getRegisterValue(8) | getRegisterValue(9) << 8;
+}
+
+unsigned A4s2600Simulator::getByteCount() const
+{
+    return std::min<unsigned>(getRegisterValue(22) | getRegisterValue(23) << 8, FifoSize);
+}
+
+unsigned A4s2600Simulator::getSpeedCounter() const
+{
+    return getRegisterValue(24) | getRegisterValue(25) << 8;
+}
+
+unsigned A4s2600Simulator::getUpperLimit() const
+{
+    return getRegisterValue(56) | getRegisterValue(57) << 8 | getRegisterValue(58) << 16;
+}
+
+unsigned A4s2600Simulator::getLowerLimit() const
+{
+    return getRegisterValue(59) | getRegisterValue(60) << 8 | getRegisterValue(61) << 16;
+}
+
+uint64_t A4s2600Simulator::getHalfClockPeriod() const
+{
+    //One exposure tick is 1us and the clock on channel 6 has the exposure time as period
+    return uint64_t(getExposure()) * 1000 / 2;
+}
+
+bool A4s2600Simulator::getClockLevel() const
+{
+    const uint64_t halfPeriod = getHalfClockPeriod();
+
+    return halfPeriod && ((now_ / halfPeriod) & 1);
+}
+
+uint8_t A4s2600Simulator::getStatus()
+{
+    uint8_t status = 0x70;
+
+    for(const Transfer &transfer : pendingTransfers_)
+    {
+        status &= ~(0x40 >> transfer.channel_);
+    }
+
+    if(getClockLevel())
+    {
+        status |= 0x01;
+    }
+
+    if(fifoLevel_ > getLowerLimit())
+    {
+        status |= 0x02;
+    }
+
+    if(fifoLevel_ > getUpperLimit())
+    {
+        status |= 0x04;
+    }
+
+    return status;
+}
+
+double A4s2600Simulator::getReflectance(unsigned channel, unsigned pixel, double position) const
+{
+    if(pixel < MaskedPixels)
+    {
+        return 0.0;
+    }
+
+    if(position < ScanAreaStart)
+    {
+        return 1.0; //The calibration strip
+    }
+
+    //A gray wedge from left to right, crossed by a dark bar every half inch
+    const double y = position - ScanAreaStart;
+    double reflectance = 0.2 + 0.75 * pixel / 5300.0;
+
+    if(fmod(y, 300.0) < 30.0)
+    {
+        reflectance = 0.1;
+    }
+
+    switch(channel)
+    {
+    case 0: return reflectance * 0.95;
+    case 2: return reflectance * 0.9;
+    default: return reflectance;
+    }
+}
+
+uint8_t A4s2600Simulator::getPixel(unsigned channel, unsigned pixel, double position) const
+{
+    const bool lampOn = (getRegisterValue(16) & 0x02) == 0; //The lamp is low active
+    const double illumination = lampOn ? 0.85 + 0.15 * cos(pixel * 0.0021) : 0.0;
+
+    const double gain = 0.5 + (wmRegisters_[0x28 + channel] & 0x1F) / 16.0;
+    const double analogOffset = wmRegisters_[0x20 + channel] * 0.25;
+    const double digitalOffset = getRegisterValue(42 + 2 * channel) * 2.0;
+
+    //A bit of reproducible noise, so averaging makes a difference
+    const unsigned hash = (pixel * 2654435761u) ^ (unsigned(lineNumber_) * 40503u);
+    const double noise = ((hash >> 7) & 0xFF) / 256.0 - 0.5;
+
+    double value = getReflectance(channel, pixel, position) * illumination * 255.0 * gain;
+    value += 40.0 - analogOffset - digitalOffset + noise;
+
+    //Outside of the calibration the pixel gain of the on chip memory is applied, 0 is a gain of 1, 255 of 2
+    static const unsigned pixelGainAddress[] = {0x3800, 0x5000, 0x6800};
+
+    if((getRegisterValue(16) & 0x80) == 0 && pixel < 0x1800)
+    {
+        value *= 1.0 + memory_[pixelGainAddress[channel] + pixel] / 255.0;
+    }
+
+    return std::max(0.0, std::min(255.0, value));
+}
@@ -0,0 +1,155 @@
+#ifndef A4S2600SIMULATOR_H
+#define A4S2600SIMULATOR_H
+
+#include "parallelport.hpp"
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+
+/**
+ * @brief The A4s2600Simulator class is a software model of the scanner behind the parallel port.
+ *
+ * It decodes the addressed accesses the same way the ASIC does and models
+ * - the register file behind channel 5/6 and the status bits on channel 6
+ * - the 128 kbyte image FiFo with the byte count and the memory limits
+ * - the pixel gain in the on chip memory, which is applied while the calibration bit is off
+ * - the stepper motor and the home sensor
+ * - the free running mode, in which the ASIC starts a line and a step on every rising clock edge by itself.
+ *   It is assumed to be selected by sync and speed with the move and a channel bit held, this is not verified on a scanner
+ * - the serial shift register of the WM8144
+ *
+ * Everything runs on a virtual clock. Every bus access advances it by the time the access would
+ * take on a real port. When the status is polled repeatedly the clock jumps to the next event, so a
+ * full scan only takes milliseconds of real time.
+ */
+class A4s2600Simulator: public ParallelPortBase
+{
+public:
+    struct Statistics
+    {
+        uint64_t addressedReads_;
+        uint64_t addressedWrites_;
+        uint64_t streamedBytes_;
+        uint64_t statusPolls_;
+        uint64_t registerWrites_;
+        uint64_t wmWrites_;
+        uint64_t motorSteps_;
+        uint64_t linesCaptured_;
+        uint64_t fifoOverflows_;
+        uint64_t fifoUnderruns_;
+    };
+
+    A4s2600Simulator(unsigned asicRevision = 0xa2, unsigned hwFeatures = 0x04);
+
+    virtual void writeByte(char address, char byte);
+    virtual char readByte(char address);
+    virtual void readString(char address, char * const buffer, size_t bufferSize);
+    virtual void writeString(char address, char const*const buffer, size_t bufferSize);
+
+    virtual void writeByte(char byte);
+    virtual char readByte();
+    virtual void readString( char * const buffer, size_t bufferSize);
+    virtual void writeString(char const*const buffer, size_t bufferSize);
+
+    /**
+     * @brief setBusCost sets how much virtual time the bus accesses take
+     * @param addressedAccess Time in ns of a single addressed read or write
+     * @param streamedByte Time in ns of every byte of a string transfer
+     */
+    void setBusCost(uint64_t addressedAccess, uint64_t streamedByte);
+
+    uint64_t getVirtualTime() const { return now_; } ///< Virtual time in ns
+    const Statistics &getStatistics() const { return statistics_; }
+    void resetStatistics();
+
+    double getCarriagePosition() const { return position_; } ///< Carriage position in 1/600 inch
+    void setCarriagePosition(double position) { position_ = position; }
+
+    unsigned getRegister(unsigned address) const { return registers_[address & 0xFF]; }
+    unsigned getWmRegister(unsigned address) const { return wmRegisters_[address & 0x3F]; }
+    size_t getFifoLevel() const { return fifoLevel_; }
+
+private:
+    enum
+    {
+        FifoSize = 0x20000,
+        HomeSensorEnd = 40,      ///< The home sensor is active below this position
+        ScanAreaStart = 256,     ///< Everything in front of this is the white calibration strip
+        MaskedPixels = 20        ///< The first pixels of the CCD never see light
+    };
+
+    struct Transfer
+    {
+        uint64_t finished_;
+        unsigned channel_;
+        double position_;
+    };
+
+    unsigned asicRevision_;
+    unsigned hwFeatures_;
+
+    uint64_t now_;
+    uint64_t addressedAccessCost_;
+    uint64_t streamedByteCost_;
+    bool lastAccessWasStatusPoll_;
+    uint8_t lastStatus_;
+    unsigned identicalPolls_;
+
+    uint8_t registers_[256];
+    unsigned registerAddress_;
+    uint8_t wmRegisters_[64];
+    unsigned serialShiftRegister_;
+
+    std::vector<uint8_t> memory_;
+    unsigned memoryAddress_;
+
+    std::vector<uint8_t> fifo_;
+    size_t fifoRead_;
+    size_t fifoLevel_;
+    std::deque<Transfer> pendingTransfers_;
+
+    uint8_t motorControl_;
+    double position_;
+
+    uint8_t dataLines_;
+    std::vector<uint8_t> selectSequence_;
+    bool scannerSelected_;
+
+    Statistics statistics_;
+    uint64_t lineNumber_;
+
+    void advance(uint64_t ns);
+    void advanceTo(uint64_t time);
+    void fastForward();
+    void completeTransfers();
+
+    void writeChannel(unsigned channel, uint8_t value);
+    uint8_t readChannel(unsigned channel);
+    uint8_t readFifo();
+
+    void writeRegister(unsigned address, uint8_t value);
+    void latchSerialRegister();
+    void writeMotorControl(uint8_t value);
+    void step();
+    bool isFreeRunning() const;
+    void freeRunningLine();
+    void startTransfer(unsigned channel);
+    void captureLine(const Transfer &transfer);
+
+    unsigned getRegisterAddress(unsigned index) const;
+    unsigned getRegisterValue(unsigned index) const { return registers_[getRegisterAddress(index)]; }
+    unsigned getExposure() const;
+    unsigned getByteCount() const;
+    unsigned getSpeedCounter() const;
+    unsigned getUpperLimit() const;
+    unsigned getLowerLimit() const;
+    bool getClockLevel() const;
+    uint64_t getHalfClockPeriod() const;
+    uint8_t getStatus();
+
+    double getReflectance(unsigned channel, unsigned pixel, double position) const;
+    uint8_t getPixel(unsigned channel, unsigned pixel, double position) const;
+};
+
+#endif // A4S2600SIMULATOR_H
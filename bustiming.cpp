@@ -0,0 +1,94 @@
+#include "bustiming.hpp"
+#include "transportprofile.hpp"
+
+#include <chrono>
+
+BusTiming::BusTiming():
+    syscallCost_(0)
+{
+    //These are the gaps the driver was developed with
+    configured_[AddressSetup] = 1000;
+    configured_[AddressStrobe] = 4000;
+    configured_[AddressHold] = 1000;
+    configured_[DataSetup] = 4000;
+    configured_[DataStrobe] = 1000;
+    configured_[DataHold] = 4000;
+    configured_[ReadStrobe] = 4000;
+    configured_[ReadHold] = 1000;
+    configured_[StreamReadStrobe] = 1000;
+    configured_[StreamReadHold] = 1000;
+
+    updateEffective();
+}
+
+void BusTiming::set(Delay delay, unsigned ns)
+{
+    configured_[delay] = ns;
+    updateEffective();
+}
+
+void BusTiming::setSyscallCost(unsigned ns)
+{
+    syscallCost_ = ns;
+    updateEffective();
+}
+
+void BusTiming::updateEffective()
+{
+    for(unsigned i=0; i<DelayCount; ++i)
+    {
+        effective_[i] = configured_[i] > syscallCost_ ? configured_[i] - syscallCost_ : 0;
+    }
+}
+
+void BusTiming::load(const TransportProfile &profile)
+{
+    for(unsigned i=0; i<DelayCount; ++i)
+    {
+        configured_[i] = profile.get(getName(Delay(i)), configured_[i]);
+    }
+
+    updateEffective();
+}
+
+void BusTiming::store(TransportProfile &profile) const
+{
+    for(unsigned i=0; i<DelayCount; ++i)
+    {
+        profile.set(getName(Delay(i)), configured_[i]);
+    }
+}
+
+const char *BusTiming::getName(Delay delay)
+{
+    switch(delay)
+    {
+    case AddressSetup: return "address_setup";
+    case AddressStrobe: return "address_strobe";
+    case AddressHold: return "address_hold";
+    case DataSetup: return "data_setup";
+    case DataStrobe: return "data_strobe";
+    case DataHold: return "data_hold";
+    case ReadStrobe: return "read_strobe";
+    case ReadHold: return "read_hold";
+    case StreamReadStrobe: return "stream_read_strobe";
+    case StreamReadHold: return "stream_read_hold";
+    case DelayCount: break;
+    }
+
+    return "";
+}
+
+void BusTiming::spin(unsigned ns)
+{
+    if(ns == 0)
+    {
+        return;
+    }
+
+    const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+
+    while(std::chrono::steady_clock::now() < end)
+    {
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef BUSTIMING_H
+#define BUSTIMING_H
+
+#include <stdint.h>
+
+class TransportProfile;
+
+/**
+ * @brief The BusTiming class holds the gaps between the port accesses of an SPP bus cycle.
+ *
+ * Every gap follows an ioctl. The ioctl itself already takes some time, so only the part of a gap
+ * that is not covered by the measured syscall cost is actually waited for. Gaps that follow an
+ * access that was skipped are waited for completely.
+ *
+ * All times are in ns.
+ */
+class BusTiming
+{
+public:
+    enum Delay
+    {
+        AddressSetup,     ///< Address on the data lines / idle control before the address strobe
+        AddressStrobe,    ///< Width of the address strobe
+        AddressHold,      ///< After the address strobe
+        DataSetup,        ///< Data on the data lines before the data strobe
+        DataStrobe,       ///< Width of the data strobe
+        DataHold,         ///< After the data strobe
+        ReadStrobe,       ///< Data strobe until the data lines are read
+        ReadHold,         ///< After a read
+        StreamReadStrobe, ///< Same as ReadStrobe, but for the bytes of a string read
+        StreamReadHold,   ///< Same as ReadHold, but for the bytes of a string read
+        DelayCount
+    };
+
+    BusTiming();
+
+    unsigned get(Delay delay) const { return configured_[delay]; }
+    void set(Delay delay, unsigned ns);
+
+    unsigned getSyscallCost() const { return syscallCost_; }
+    void setSyscallCost(unsigned ns);
+
+    /**
+     * @brief getEffective returns the part of the delay that needs to be waited for
+     * @param delay The delay
+     * @param afterSyscall true if the delay follows an ioctl that was actually issued
+     */
+    unsigned getEffective(Delay delay, bool afterSyscall = true) const { return afterSyscall ? effective_[delay] : configured_[delay]; }
+
+    void wait(Delay delay, bool afterSyscall = true) const { spin(getEffective(delay, afterSyscall)); }
+
+    void load(const TransportProfile &profile);
+    void store(TransportProfile &profile) const;
+
+    static const char *getName(Delay delay);
+    static void spin(unsigned ns);
+
+private:
+    unsigned configured_[DelayCount];
+    unsigned effective_[DelayCount];
+    unsigned syscallCost_;
+
+    void updateEffective();
+};
+
+#endif // BUSTIMING_H
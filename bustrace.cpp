@@ -0,0 +1,137 @@
+#include "bustrace.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <functional>
+#include <system_error>
+
+static const char traceMagic[8] = {'S','E','1','2','T','R','C','1'};
+
+BusTraceRecorder::BusTraceRecorder(size_t capacity):
+    head_(0),
+    tail_(0),
+    dropped_(false),
+    running_(false),
+    startTime_(std::chrono::steady_clock::now()),
+    file_(nullptr),
+    thread_(nullptr)
+{
+    //The capacity is rounded up to a power of two, so the index is a simple mask
+    size_t size = 1;
+
+    while(size < capacity)
+    {
+        size <<= 1;
+    }
+
+    //The ring is only allocated while a trace is open
+    mask_ = size - 1;
+}
+
+BusTraceRecorder::~BusTraceRecorder()
+{
+    close();
+}
+
+void BusTraceRecorder::open(const std::string &filename)
+{
+    close();
+
+    file_ = fopen(filename.c_str(), "wb");
+
+    if(!file_)
+    {
+        std::error_code error(errno,std::system_category());
+        throw std::system_error(error,"Failed to open the trace file "+filename);
+    }
+
+    fwrite(traceMagic, sizeof(traceMagic), 1, file_);
+
+    ring_.resize(mask_ + 1);
+
+    head_.store(0);
+    tail_.store(0);
+    dropped_.store(false);
+    running_.store(true);
+
+    thread_ = new std::thread(std::bind(&BusTraceRecorder::run, this));
+}
+
+void BusTraceRecorder::close()
+{
+    if(thread_)
+    {
+        running_.store(false);
+        thread_->join();
+        delete thread_;
+        thread_ = nullptr;
+    }
+
+    if(file_)
+    {
+        drain();
+        fclose(file_);
+        file_ = nullptr;
+    }
+
+    std::vector<BusTraceEvent>().swap(ring_);
+}
+
+void BusTraceRecorder::drain()
+{
+    const size_t head = head_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_relaxed);
+
+    while(tail != head)
+    {
+        //Write the ring buffer in at most two contiguous chunks
+        const size_t start = tail & mask_;
+        const size_t count = std::min(head - tail, ring_.size() - start);
+
+        fwrite(&ring_[start], sizeof(BusTraceEvent), count, file_);
+
+        tail += count;
+        tail_.store(tail, std::memory_order_release);
+    }
+}
+
+void BusTraceRecorder::run()
+{
+    while(running_.load())
+    {
+        drain();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+bool BusTraceRecorder::load(const std::string &filename, std::vector<BusTraceEvent> &events)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    char magic[sizeof(traceMagic)];
+
+    if(!file)
+    {
+        return false;
+    }
+
+    if(fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, traceMagic, sizeof(magic)) != 0)
+    {
+        fclose(file);
+        return false;
+    }
+
+    BusTraceEvent event;
+
+    events.clear();
+
+    while(fread(&event, sizeof(event), 1, file) == 1)
+    {
+        events.push_back(event);
+    }
+
+    fclose(file);
+
+    return true;
+}
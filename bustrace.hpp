@@ -0,0 +1,90 @@
+#ifndef BUSTRACE_H
+#define BUSTRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The BusTraceEvent struct is one recorded bus access, as it is stored in the trace file.
+ */
+struct BusTraceEvent
+{
+    enum Flags
+    {
+        Write = 0x01,  ///< The access was a write, otherwise a read
+        Dropped = 0x02 ///< Events were lost in front of this one because the ring buffer was full
+    };
+
+    uint32_t timestamp_; ///< us since the start of the recording
+    uint8_t address_;
+    uint8_t data_;
+    uint8_t flags_;
+    uint8_t reserved_;
+};
+
+/**
+ * @brief The BusTraceRecorder class records bus accesses into a ring buffer that is allocated when the trace is opened.
+ *
+ * Recording is lock free and never blocks: a background thread drains the ring buffer into the
+ * trace file. If the thread can not keep up, events are dropped and the next recorded event is
+ * flagged with BusTraceEvent::Dropped. Events recorded while no trace is open are dropped. Only one thread may
+ * record at a time.
+ */
+class BusTraceRecorder
+{
+public:
+    BusTraceRecorder(size_t capacity = 1<<20);
+    ~BusTraceRecorder();
+
+    void open(const std::string &filename);
+    void close();
+    bool isOpen() const { return file_ != nullptr; }
+
+    void restartClock() { startTime_ = std::chrono::steady_clock::now(); }
+
+    void record(uint8_t address, uint8_t data, bool write)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+
+        if(head - tail_.load(std::memory_order_acquire) >= ring_.size())
+        {
+            dropped_.store(true, std::memory_order_relaxed);
+            return;
+        }
+
+        BusTraceEvent &event = ring_[head & mask_];
+
+        event.timestamp_ = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime_).count();
+        event.address_ = address;
+        event.data_ = data;
+        event.flags_ = (write ? BusTraceEvent::Write : 0) | (dropped_.exchange(false, std::memory_order_relaxed) ? BusTraceEvent::Dropped : 0);
+        event.reserved_ = 0;
+
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    static bool load(const std::string &filename, std::vector<BusTraceEvent> &events);
+
+private:
+    std::vector<BusTraceEvent> ring_;
+    size_t mask_;
+    std::atomic<size_t> head_;
+    std::atomic<size_t> tail_;
+    std::atomic<bool> dropped_;
+    std::atomic<bool> running_;
+    std::chrono::steady_clock::time_point startTime_;
+
+    FILE *file_;
+    std::thread *thread_;
+
+    void drain();
+    void run();
+};
+
+#endif // BUSTRACE_H
@@ -0,0 +1,54 @@
+#include "bustrace.hpp"
+
+#include <iostream>
+
+/*
+ * Converts a binary bus trace into the text format of the logic analyser viewer:
+ *
+ *   bustrace2txt trace.bin > trace.txt
+ */
+int main(int argc, char *argv[])
+{
+    if(argc != 2)
+    {
+        std::cerr<<"Usage: "<<argv[0]<<" <trace file>"<<std::endl;
+        return -1;
+    }
+
+    std::vector<BusTraceEvent> events;
+
+    if(!BusTraceRecorder::load(argv[1], events))
+    {
+        std::cerr<<"Failed to read the trace "<<argv[1]<<std::endl;
+        return -1;
+    }
+
+    std::cout<<";Rate: 1000000\n";
+    std::cout<<";Channels: 32\n";
+
+    unsigned dropped = 0;
+
+    for(const BusTraceEvent &event : events)
+    {
+        uint32_t output = (uint32_t(event.address_) << 8) | event.data_;
+
+        if(event.flags_ & BusTraceEvent::Write)
+        {
+            output |= 0x10000;
+        }
+
+        if(event.flags_ & BusTraceEvent::Dropped)
+        {
+            ++dropped;
+        }
+
+        std::cout<<std::hex<<output<<"@"<<std::dec<<event.timestamp_<<"\n";
+    }
+
+    if(dropped)
+    {
+        std::cerr<<"The trace has "<<dropped<<" gaps where events were dropped"<<std::endl;
+    }
+
+    return 0;
+}
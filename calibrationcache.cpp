@@ -0,0 +1,250 @@
+#include "calibrationcache.hpp"
+
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char cacheMagic[8] = {'S','E','1','2','C','A','L','1'};
+
+static void writeValue(FILE *file, uint32_t value)
+{
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+static bool readValue(FILE *file, uint32_t &value)
+{
+    return fread(&value, sizeof(value), 1, file) == 1;
+}
+
+static void writeLine(FILE *file, const std::vector<uint8_t> &line)
+{
+    writeValue(file, line.size());
+
+    if(!line.empty())
+    {
+        fwrite(&line[0], line.size(), 1, file);
+    }
+}
+
+static bool readLine(FILE *file, std::vector<uint8_t> &line)
+{
+    uint32_t size;
+
+    if(!readValue(file, size) || size > 0x10000)
+    {
+        return false;
+    }
+
+    line.resize(size);
+
+    return size == 0 || fread(&line[0], size, 1, file) == 1;
+}
+
+bool CalibrationCache::Key::operator<(const Key &other) const
+{
+    if(asicRevision_ != other.asicRevision_)
+    {
+        return asicRevision_ < other.asicRevision_;
+    }
+
+    if(hwFeatures_ != other.hwFeatures_)
+    {
+        return hwFeatures_ < other.hwFeatures_;
+    }
+
+    return dpi_ < other.dpi_;
+}
+
+CalibrationCache::CalibrationCache(const std::string &filename):
+    filename_(filename)
+{
+}
+
+bool CalibrationCache::load()
+{
+    if(filename_.empty())
+    {
+        return false;
+    }
+
+    FILE *file = fopen(filename_.c_str(), "rb");
+    char magic[sizeof(cacheMagic)];
+
+    if(!file)
+    {
+        return false;
+    }
+
+    if(fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, cacheMagic, sizeof(magic)) != 0)
+    {
+        fclose(file);
+        return false;
+    }
+
+    std::map<Key, Entry> entries;
+    uint32_t count = 0;
+    bool valid = readValue(file, count);
+
+    for(uint32_t i=0; i<count && valid; ++i)
+    {
+        Key key;
+        Entry entry;
+        uint32_t value[2];
+
+        valid = readValue(file, value[0]) && readValue(file, value[1]);
+        key.asicRevision_ = value[0];
+        key.hwFeatures_ = value[1];
+        valid = valid && readValue(file, value[0]);
+        key.dpi_ = value[0];
+        valid = valid && fread(&entry.created_, sizeof(entry.created_), 1, file) == 1;
+
+        bool matches = true;
+
+        for(ScannerControl::ChannelCalibration &channel : entry.calibration_.channels_)
+        {
+            uint32_t values[4];
+
+            for(uint32_t &v : values)
+            {
+                valid = valid && readValue(file, v);
+            }
+
+            channel.valid_ = values[0] != 0;
+            channel.pgaGain_ = values[1];
+            channel.pgaOffset_ = values[2];
+            channel.digitalOffset_ = values[3];
+
+            valid = valid && readLine(file, channel.white_) && readLine(file, channel.dark_);
+
+            //Lines of another CCD width would be indexed out of bounds by the shading correction
+            if(channel.valid_ && (channel.white_.size() != ScannerControl::getCcdWidth() ||
+                                  channel.dark_.size() != ScannerControl::getCcdWidth()))
+            {
+                matches = false;
+            }
+        }
+
+        if(matches)
+        {
+            entries[key] = entry;
+        }
+    }
+
+    fclose(file);
+
+    //A broken file is treated like an empty one
+    if(valid)
+    {
+        entries_ = entries;
+    }
+
+    return valid;
+}
+
+bool CalibrationCache::save() const
+{
+    if(filename_.empty())
+    {
+        return false;
+    }
+
+    //Written next to the cache and renamed, so a concurrent reader never sees half a file
+    const std::string temporary = filename_ + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+
+    if(!file)
+    {
+        return false;
+    }
+
+    fwrite(cacheMagic, sizeof(cacheMagic), 1, file);
+    writeValue(file, entries_.size());
+
+    for(const auto &entry : entries_)
+    {
+        writeValue(file, entry.first.asicRevision_);
+        writeValue(file, entry.first.hwFeatures_);
+        writeValue(file, entry.first.dpi_);
+        fwrite(&entry.second.created_, sizeof(entry.second.created_), 1, file);
+
+        for(const ScannerControl::ChannelCalibration &channel : entry.second.calibration_.channels_)
+        {
+            writeValue(file, channel.valid_ ? 1 : 0);
+            writeValue(file, channel.pgaGain_);
+            writeValue(file, channel.pgaOffset_);
+            writeValue(file, channel.digitalOffset_);
+            writeLine(file, channel.white_);
+            writeLine(file, channel.dark_);
+        }
+    }
+
+    const bool success = ferror(file) == 0;
+
+    if(fclose(file) != 0 || !success)
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+
+    return rename(temporary.c_str(), filename_.c_str()) == 0;
+}
+
+bool CalibrationCache::find(const Key &key, ScannerControl::Calibration &calibration, time_t &created) const
+{
+    auto entry = entries_.find(key);
+
+    if(entry == entries_.end())
+    {
+        return false;
+    }
+
+    calibration = entry->second.calibration_;
+    created = entry->second.created_;
+
+    return true;
+}
+
+void CalibrationCache::store(const Key &key, const ScannerControl::Calibration &calibration)
+{
+    Entry &entry = entries_[key];
+
+    entry.created_ = time(nullptr);
+    entry.calibration_ = calibration;
+}
+
+std::string CalibrationCache::defaultFilename()
+{
+    const char *filename = getenv("SANE_SE12000P_CALIBRATION");
+
+    if(filename)
+    {
+        return filename;
+    }
+
+    const char *cache = getenv("XDG_CACHE_HOME");
+
+    if(cache)
+    {
+        return std::string(cache) + "/se12000p-calibration";
+    }
+
+    const char *home = getenv("HOME");
+
+    if(!home)
+    {
+        const struct passwd *user = getpwuid(getuid());
+
+        home = user ? user->pw_dir : nullptr;
+    }
+
+    if(home)
+    {
+        return std::string(home) + "/.cache/se12000p-calibration";
+    }
+
+    //A shared directory like /tmp could be prepared by another user, without a home there is no cache
+    return std::string();
+}
@@ -0,0 +1,56 @@
+#ifndef CALIBRATIONCACHE_H
+#define CALIBRATIONCACHE_H
+
+#include "scannercontrol.hpp"
+
+#include <stdint.h>
+#include <map>
+#include <string>
+
+/**
+ * @brief The CalibrationCache class keeps the results of calibrateScanner() in a file, so they can be
+ * reused by later scans and other processes.
+ *
+ * An entry is valid for one ASIC revision, hardware feature set and resolution. Every entry carries the
+ * time it was measured, it is up to the user to decide how old an entry may be.
+ */
+class CalibrationCache
+{
+public:
+    struct Key
+    {
+        unsigned asicRevision_;
+        unsigned hwFeatures_;
+        unsigned dpi_;
+
+        bool operator<(const Key &other) const;
+    };
+
+    CalibrationCache(const std::string &filename);
+
+    bool load();
+    bool save() const;
+
+    /**
+     * @brief find returns the calibration stored for key and the time it was measured
+     */
+    bool find(const Key &key, ScannerControl::Calibration &calibration, time_t &created) const;
+    void store(const Key &key, const ScannerControl::Calibration &calibration);
+
+    /**
+     * @brief defaultFilename returns the cache file in the home of the user, or an empty name (no cache) if there is no home
+     */
+    static std::string defaultFilename();
+
+private:
+    struct Entry
+    {
+        int64_t created_;
+        ScannerControl::Calibration calibration_;
+    };
+
+    std::string filename_;
+    std::map<Key, Entry> entries_;
+};
+
+#endif // CALIBRATIONCACHE_H
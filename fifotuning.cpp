@@ -0,0 +1,58 @@
+#include "fifotuning.hpp"
+#include "a4s2600.hpp"
+#include "transportprofile.hpp"
+
+#include <algorithm>
+
+enum
+{
+    DefaultThroughput = 100000, //Bytes per second, a slow SPP port
+    MinimumChunk = 64
+};
+
+FifoTuning::FifoTuning():
+    throughput_(DefaultThroughput),
+    bytesPerLine_(1),
+    period_(0),
+    chunk_(MinimumChunk),
+    upperLimit_(0)
+{
+}
+
+void FifoTuning::plan(size_t bytesPerLine, unsigned period)
+{
+    const size_t capacity = size_t(A4s2600::lastOnChipMemoryAddress) + 1;
+
+    bytesPerLine_ = std::max<size_t>(bytesPerLine, 1);
+    period_ = period;
+
+    //A quarter of a period leaves the other half of the clock level for the polling
+    chunk_ = uint64_t(throughput_) * period / 4000000;
+    chunk_ = std::max<size_t>(MinimumChunk, std::min(chunk_, bytesPerLine_));
+
+    //When the limit is seen the line of this period is still transferred, one more is kept as margin
+    upperLimit_ = capacity > 3 * bytesPerLine_ ? capacity - 2 * bytesPerLine_ : bytesPerLine_;
+}
+
+void FifoTuning::setThroughput(unsigned bytesPerSecond)
+{
+    throughput_ = std::max<unsigned>(bytesPerSecond, 1);
+}
+
+void FifoTuning::measured(uint64_t bytes, uint64_t time)
+{
+    if(time > 0 && bytes > 0)
+    {
+        setThroughput(bytes * 1000000 / time);
+    }
+}
+
+void FifoTuning::load(const TransportProfile &profile)
+{
+    setThroughput(profile.get("bus_throughput", throughput_));
+}
+
+void FifoTuning::store(TransportProfile &profile) const
+{
+    profile.set("bus_throughput", throughput_);
+}
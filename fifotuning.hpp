@@ -0,0 +1,63 @@
+#ifndef FIFOTUNING_H
+#define FIFOTUNING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class TransportProfile;
+
+/**
+ * @brief The FifoTuning class works out how the 128 kbyte on chip memory is used as FIFO during a scan.
+ *
+ * The scan loop has to see every period of the exposure clock, so the FIFO is drained in chunks that take
+ * at most a quarter of a period at the bus throughput. The lower limit says when a chunk is there. The upper
+ * limit, above which the motor waits, leaves room for the line being transferred and one more, so short lines
+ * (low resolution, cropped) buffer a lot more lines than long ones.
+ *
+ * The throughput is measured while scanning, as the bytes read in clock periods in which the FIFO never ran
+ * empty. It is kept in the transport profile as bus_throughput (bytes per second).
+ */
+class FifoTuning
+{
+public:
+    FifoTuning();
+
+    /**
+     * @brief plan works out the chunk size and the limits
+     * @param bytesPerLine Bytes the ASIC transfers into the FIFO per line
+     * @param period Period of the exposure clock in us, one line is taken per period
+     */
+    void plan(size_t bytesPerLine, unsigned period);
+
+    size_t getChunk() const { return chunk_; }
+    unsigned getLowerLimit() const { return chunk_ - 1; }
+    unsigned getUpperLimit() const { return upperLimit_; }
+    unsigned getBufferedLines() const { return upperLimit_ / bytesPerLine_; }
+
+    /**
+     * @brief keepsUp tells if the bus drains a line per period, otherwise the FIFO fills up unless the motor waits
+     */
+    bool keepsUp() const { return uint64_t(throughput_) * period_ >= uint64_t(bytesPerLine_) * 1000000; }
+
+    unsigned getThroughput() const { return throughput_; }
+    void setThroughput(unsigned bytesPerSecond);
+
+    /**
+     * @brief measured updates the throughput with what the FIFO was drained with
+     * @param bytes Bytes read in periods the bus was busy all the time
+     * @param time Length of these periods in us
+     */
+    void measured(uint64_t bytes, uint64_t time);
+
+    void load(const TransportProfile &profile);
+    void store(TransportProfile &profile) const;
+
+private:
+    unsigned throughput_;
+    size_t bytesPerLine_;
+    unsigned period_;
+    size_t chunk_;
+    unsigned upperLimit_;
+};
+
+#endif // FIFOTUNING_H
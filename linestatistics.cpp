@@ -0,0 +1,129 @@
+#include "linestatistics.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define STATISTICS_X86
+#include <emmintrin.h>
+#endif
+
+#ifdef STATISTICS_X86
+
+static bool hasSse2()
+{
+    static const bool supported = __builtin_cpu_supports("sse2");
+
+    return supported;
+}
+
+__attribute__((target("sse2")))
+static size_t sumSse2(const uint8_t *line, size_t count, uint32_t &result)
+{
+    //The sum of absolute differences to zero adds up 8 bytes into each 64 bit half
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+
+    for(; i + 16 <= count; i += 16)
+    {
+        total = _mm_add_epi64(total, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(line + i)), _mm_setzero_si128()));
+    }
+
+    result = _mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(total, total));
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t accumulateSse2(uint16_t *sum, const uint8_t *line, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for(; i + 16 <= count; i += 16)
+    {
+        const __m128i pixels = _mm_loadu_si128((const __m128i*)(line + i));
+        __m128i *low = (__m128i*)(sum + i);
+        __m128i *high = (__m128i*)(sum + i + 8);
+
+        _mm_storeu_si128(low, _mm_adds_epu16(_mm_loadu_si128(low), _mm_unpacklo_epi8(pixels, zero)));
+        _mm_storeu_si128(high, _mm_adds_epu16(_mm_loadu_si128(high), _mm_unpackhi_epi8(pixels, zero)));
+    }
+
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t maximumSse2(uint8_t *maximum, const uint8_t *line, size_t count)
+{
+    size_t i = 0;
+
+    for(; i + 16 <= count; i += 16)
+    {
+        __m128i *result = (__m128i*)(maximum + i);
+
+        _mm_storeu_si128(result, _mm_max_epu8(_mm_loadu_si128(result), _mm_loadu_si128((const __m128i*)(line + i))));
+    }
+
+    return i;
+}
+
+#endif
+
+/* The SSE2 functions return how many pixels they handled, the plain loops take care of the rest */
+
+uint32_t LineStatistics::sum(const uint8_t *line, size_t count)
+{
+    uint32_t result = 0;
+    size_t i = 0;
+
+#ifdef STATISTICS_X86
+    if(hasSse2())
+    {
+        i = sumSse2(line, count, result);
+    }
+#endif
+
+    for(; i<count; ++i)
+    {
+        result += line[i];
+    }
+
+    return result;
+}
+
+void LineStatistics::accumulate(uint16_t *sum, const uint8_t *line, size_t count)
+{
+    size_t i = 0;
+
+#ifdef STATISTICS_X86
+    if(hasSse2())
+    {
+        i = accumulateSse2(sum, line, count);
+    }
+#endif
+
+    for(; i<count; ++i)
+    {
+        const unsigned value = sum[i] + line[i];
+
+        sum[i] = value > 0xFFFF ? 0xFFFF : value;
+    }
+}
+
+void LineStatistics::maximum(uint8_t *maximum, const uint8_t *line, size_t count)
+{
+    size_t i = 0;
+
+#ifdef STATISTICS_X86
+    if(hasSse2())
+    {
+        i = maximumSse2(maximum, line, count);
+    }
+#endif
+
+    for(; i<count; ++i)
+    {
+        if(line[i] > maximum[i])
+        {
+            maximum[i] = line[i];
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef LINESTATISTICS_H
+#define LINESTATISTICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief The LineStatistics class has the reductions the calibration runs over scanned lines.
+ *
+ * They use SSE2 if the CPU has it, otherwise a plain loop.
+ */
+class LineStatistics
+{
+public:
+    /**
+     * @brief sum returns the sum of all pixels
+     */
+    static uint32_t sum(const uint8_t *line, size_t count);
+
+    /**
+     * @brief accumulate adds every pixel of the line to its sum, a sum saturates at 0xFFFF
+     */
+    static void accumulate(uint16_t *sum, const uint8_t *line, size_t count);
+
+    /**
+     * @brief maximum keeps the larger value of every pixel in maximum
+     */
+    static void maximum(uint8_t *maximum, const uint8_t *line, size_t count);
+};
+
+#endif // LINESTATISTICS_H
@@ -17,7 +17,7 @@
 
 using namespace std;
 
-std::shared_ptr<ParallelPortSpp> spp;
+std::shared_ptr<ParallelPortBase> spp;
 uint8_t *image;
 
 
@@ -26,7 +26,7 @@ int main()
     try
     {
 
-        spp = std::make_shared<ParallelPortSpp>("/dev/parport0");
+        spp.reset(ParallelPortBase::openPort(ParallelPortBase::defaultDevice()));
 
         ScannerControl::switchToScanner(*spp);
 
@@ -43,7 +43,8 @@ int main()
         image = (uint8_t*)malloc(sizeof(uint8_t)*5300*height);
 
 
-        asic.setCalibration(true);
+        //Without the calibration bit the ASIC applies the uploaded pixel gain
+        asic.setCalibration(scanner.getShadingMode() == ScannerControl::SoftwareShading);
 
         scanner.moveToStartPosition();
 
@@ -1,4 +1,6 @@
 #include "parallelport.hpp"
+#include "a4s2600simulator.hpp"
+#include "parallelportreplay.hpp"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -6,45 +8,231 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <linux/parport.h>
 #include <linux/ppdev.h>
 #include <exception>
 #include <errno.h>
 #include <string.h>
 #include <system_error>
+#include <stdexcept>
 #include <unistd.h>
 #include <chrono>
 #include <iostream>
-#include <ios>
 
-typedef std::chrono::duration<uint64_t, std::ratio<1,1000000> > UsDuration;
+BusProgram::BusProgram():
+    translatedBy_(nullptr),
+    timingRevision_(0),
+    skippedCycles_(0),
+    finalControl_(-1),
+    finalData_(-1),
+    translated_(false)
+{
+}
 
-static void udelay(unsigned useconds)
+void BusProgram::write(char address, char byte)
 {
+    Operation operation;
 
-    auto start = std::chrono::high_resolution_clock::now();
-    UsDuration spawn;
-    do
-    {
-        spawn = std::chrono::duration_cast<UsDuration>(std::chrono::high_resolution_clock::now() - start);
-    }while(spawn.count()<useconds);
+    operation.address_ = address;
+    operation.data_ = byte;
+    operation.result_ = nullptr;
+
+    operations_.push_back(operation);
+    translated_ = false;
+}
+
+void BusProgram::read(char address, char *result)
+{
+    Operation operation;
+
+    operation.address_ = address;
+    operation.data_ = 0;
+    operation.result_ = result;
+
+    operations_.push_back(operation);
+    translated_ = false;
 }
 
+void BusProgram::clear()
+{
+    operations_.clear();
+    cycles_.clear();
+    translated_ = false;
+}
+
+/* ------------------------------------------------------------------------------------------*/
+
 ParallelPortBase::ParallelPortBase(int fd):
-    fd_(fd)
+    fd_(fd),
+    timingRevision_(0),
+    isLogging_(false)
 {
+    invalidatePortState();
+    resetIoctlStatistics();
+
     execAndCheck(fd_, "Failed to open parallel port");
     execAndCheck(ioctl(fd,PPCLAIM),"Failed to claim the parallel port");
 }
 
+ParallelPortBase::ParallelPortBase():
+    fd_(-1),
+    timingRevision_(0),
+    isLogging_(false)
+{
+    invalidatePortState();
+    resetIoctlStatistics();
+}
+
 ParallelPortBase::~ParallelPortBase()
 {
-    close(fd_);
+    if(fd_ >= 0)
+    {
+        close(fd_);
+    }
 }
 
 void ParallelPortBase::changeMode(int mode)
 {
+    if(mode_ == mode)
+    {
+        ++ioctlStatistics_.skipped_;
+        return;
+    }
+
     execAndCheck(ioctl(fd_, PPSETMODE, &mode), "PP Modechage failed "+std::to_string(mode));
+    ++ioctlStatistics_.issued_;
+
+    //Nothing is known about the lines after a mode change
+    invalidatePortState();
+    mode_ = mode;
+}
+
+void ParallelPortBase::invalidatePortState()
+{
+    mode_ = UnknownState;
+    dataDirection_ = UnknownState;
+    control_ = UnknownState;
+    data_ = UnknownState;
+}
+
+void ParallelPortBase::resetIoctlStatistics()
+{
+    ioctlStatistics_.issued_ = 0;
+    ioctlStatistics_.skipped_ = 0;
+}
+
+void ParallelPortBase::setTiming(const BusTiming &timing)
+{
+    timing_ = timing;
+    ++timingRevision_; //Translated programs contain the old delays
+}
+
+void ParallelPortBase::setDataDirection(bool input)
+{
+    const int direction = input ? 1 : 0;
+
+    if(dataDirection_ == direction)
+    {
+        ++ioctlStatistics_.skipped_;
+        return;
+    }
+
+    execAndCheck(ioctl(fd_, PPDATADIR, &direction), "PP data direction change failed");
+    ++ioctlStatistics_.issued_;
+
+    dataDirection_ = direction;
+    data_ = UnknownState;
+}
+
+bool ParallelPortBase::writeControl(unsigned char control)
+{
+    if(control_ == control)
+    {
+        ++ioctlStatistics_.skipped_;
+        return false;
+    }
+
+    execAndCheck(ioctl(fd_, PPWCONTROL, &control), "Write control to PP failed");
+    ++ioctlStatistics_.issued_;
+
+    control_ = control;
+    return true;
+}
+
+bool ParallelPortBase::writeData(unsigned char data)
+{
+    if(data_ == data)
+    {
+        ++ioctlStatistics_.skipped_;
+        return false;
+    }
+
+    execAndCheck(ioctl(fd_, PPWDATA, &data), "Write to PP failed");
+    ++ioctlStatistics_.issued_;
+
+    data_ = data;
+    return true;
+}
+
+unsigned char ParallelPortBase::readData()
+{
+    unsigned char data = 0;
+
+    execAndCheck(ioctl(fd_, PPRDATA, &data), "Read from PP failed");
+    ++ioctlStatistics_.issued_;
+
+    return data;
+}
+
+void ParallelPortBase::execute(BusProgram &program)
+{
+    for(const BusProgram::Operation &operation : program.operations_)
+    {
+        if(operation.result_)
+        {
+            *operation.result_ = readByte(operation.address_);
+        }else
+        {
+            writeByte(operation.address_, operation.data_);
+        }
+    }
+}
+
+ParallelPortBase *ParallelPortBase::openPort(const std::string &device)
+{
+    if(device == "simulator")
+    {
+        return new A4s2600Simulator();
+    }
+
+    if(device.compare(0, 7, "replay:") == 0)
+    {
+        return new ParallelPortReplay(device.substr(7));
+    }
+
+    //The EPP transport has not been verified against the scanner, it is only used when asked for
+    const char *epp = getenv("SANE_SE12000P_EPP");
+
+    if(epp && std::string(epp) == "1")
+    {
+        try
+        {
+            return new ParallelPortEpp(device);
+        }catch(const std::exception &e)
+        {
+            std::cerr<<"EPP not available ("<<e.what()<<"), falling back to SPP"<<std::endl;
+        }
+    }
+
+    return new ParallelPortSpp(device);
+}
+
+std::string ParallelPortBase::defaultDevice()
+{
+    const char *device = getenv("SANE_SE12000P_DEVICE");
+
+    return device ? device : "/dev/parport0";
 }
 
 void ParallelPortBase::execAndCheck(bool retValue, const std::string &message)
@@ -56,7 +244,7 @@ void ParallelPortBase::execAndCheck(bool retValue, const std::string &message)
     }
 }
 
-void ParallelPortBase::execAndCheck(int retValue, const std::__cxx11::string &message)
+void ParallelPortBase::execAndCheck(int retValue, const std::string &message)
 {
     execAndCheck(retValue>=0, message);
 }
@@ -64,15 +252,17 @@ void ParallelPortBase::execAndCheck(int retValue, const std::__cxx11::string &me
 
 void ParallelPortBase::setupLogFile(const std::string &filename)
 {
-    logfile_.open(filename,std::ios_base::trunc | std::ios_base::out);
-    logfile_<<";Rate: 1000000"<<std::endl;
-    logfile_<<";Channels: 32"<<std::endl;
+    isLogging_ = false;
+    trace_.open(filename);
 }
 
 void ParallelPortBase::startLogging()
 {
-    logStartTime_ = std::chrono::high_resolution_clock::now();
-    isLogging_ = true;
+    if(trace_.isOpen())
+    {
+        trace_.restartClock();
+        isLogging_ = true;
+    }
 }
 
 void ParallelPortBase::stopLogging()
@@ -80,140 +270,227 @@ void ParallelPortBase::stopLogging()
     isLogging_ = false;
 }
 
-void ParallelPortBase::logRead(char address, char data)
+
+ParallelPortEpp::ParallelPortEpp(int fd): ParallelPortBase(fd)
 {
-    if(isLogging_)
-    {
-        uint32_t output = (uint32_t(address)&0xFF) << 8 | (uint32_t(data)&0xFF);
+    negotiateEpp();
+}
 
-        logfile_<<std::hex<<output<<"@";
-        logfile_<<std::dec<<std::chrono::duration_cast<UsDuration>(std::chrono::high_resolution_clock::now() - logStartTime_).count()<<std::endl;
-    }
+ParallelPortEpp::ParallelPortEpp(const std::string &device): ParallelPortBase(open(device.c_str(),O_RDWR))
+{
+    negotiateEpp();
 }
 
-void ParallelPortBase::logWrite(char address, char data)
+void ParallelPortEpp::negotiateEpp()
 {
-    if(isLogging_)
+    unsigned int modes = 0;
+
+    execAndCheck(ioctl(fd_, PPGETMODES, &modes), "Failed to query the parallel port modes");
+
+    if(!(modes & PARPORT_MODE_EPP))
     {
-        uint32_t output = 0x10000 | (uint32_t(address)&0xFF) << 8 | (uint32_t(data)&0xFF);
-        logfile_<<std::hex<<output<<"@";
-        logfile_<<std::dec<<std::chrono::duration_cast<UsDuration>(std::chrono::high_resolution_clock::now() - logStartTime_).count()<<std::endl;
+        throw std::runtime_error("Parallel port does not support EPP");
     }
+
+    changeMode(IEEE1284_MODE_EPP | IEEE1284_DATA);
 }
 
+void ParallelPortEpp::writeAddress(char address)
+{
+    //Switching between address and data cycles is a PPSETMODE each time, changeMode skips it when possible
+    changeMode(IEEE1284_MODE_EPP | IEEE1284_ADDR);
+    execAndCheck(write(fd_,&address, sizeof(address)) == sizeof(address), "EPP Write to PP failed");
+    changeMode(IEEE1284_MODE_EPP | IEEE1284_DATA);
+}
 
-ParallelPortEpp::ParallelPortEpp(int fd): ParallelPortBase(fd)
+void ParallelPortEpp::readBlock(char *buffer, size_t bufferSize)
 {
+    //ppdev hands out at most PP_BUFFER_SIZE bytes per call, so a line may still take a few calls
+    while(bufferSize > 0)
+    {
+        ssize_t bytesRead = read(fd_, buffer, bufferSize);
+
+        execAndCheck(bytesRead > 0, "EPP Read from PP failed");
+        data_ = UnknownState; //The EPP cycle drives the data lines
+
+        buffer += bytesRead;
+        bufferSize -= bytesRead;
+    }
+}
+
+void ParallelPortEpp::writeBlock(char const *buffer, size_t bufferSize)
+{
+    while(bufferSize > 0)
+    {
+        ssize_t bytesWritten = write(fd_, buffer, bufferSize);
+
+        execAndCheck(bytesWritten > 0, "EPP Write to PP failed");
+        data_ = UnknownState;
+
+        buffer += bytesWritten;
+        bufferSize -= bytesWritten;
+    }
 }
 
 char ParallelPortEpp::readByte(char address)
 {
-    changeMode(IEEE1284_MODE_EPP | IEEE1284_ADDR);
-    execAndCheck(write(fd_,&address, sizeof(address)) == sizeof(address), "Write to PP failed");
-    changeMode(IEEE1284_MODE_EPP | IEEE1284_DATA);
     char result;
-    execAndCheck(read(fd_,&result, sizeof(result)) == sizeof(result), "EPP Read from PP failed");
+
+    writeAddress(address);
+    readBlock(&result, sizeof(result));
+
+    logRead(address, result);
 
     return result;
 }
 
 void ParallelPortEpp::readString(char address, char * const buffer, size_t bufferSize)
 {
-    changeMode(IEEE1284_MODE_EPP | IEEE1284_ADDR);
-    execAndCheck(write(fd_,&address, sizeof(address)) == sizeof(address), "EPP Write to PP failed");
-    changeMode(IEEE1284_MODE_EPP | IEEE1284_DATA);
+    writeAddress(address);
+    readBlock(buffer, bufferSize);
 
-    char *bp = buffer;
-    for(size_t i = bufferSize; i>0; --i,++bp )
+    if(isLogging_)
     {
-        execAndCheck(read(fd_,bp, 1) == 1, "EPP Read from PP failed");
+        for(size_t i = 0; i<bufferSize; ++i)
+        {
+            logRead(address, buffer[i]);
+        }
     }
 }
 
 void ParallelPortEpp::writeByte(char address, char byte)
 {
-    changeMode(IEEE1284_MODE_EPP | IEEE1284_ADDR);
-    execAndCheck(write(fd_,&address, sizeof(address)) == sizeof(address), "Write to PP failed");
-    changeMode(IEEE1284_MODE_EPP | IEEE1284_DATA);
+    writeAddress(address);
+    writeBlock(&byte, sizeof(byte));
 
-    execAndCheck(write(fd_,&byte, sizeof(byte)) == sizeof(byte), "EPP Write to PP failed");
+    logWrite(address, byte);
 }
 
 void ParallelPortEpp::writeString(char address, char const * const buffer, size_t bufferSize)
 {
-    changeMode(IEEE1284_MODE_EPP | IEEE1284_ADDR);
-    execAndCheck(write(fd_,&address, sizeof(address)) == sizeof(address), "Write to PP failed");
-    changeMode(IEEE1284_MODE_EPP | IEEE1284_DATA);
+    writeAddress(address);
+    writeBlock(buffer, bufferSize);
 
-    char const* bp = buffer;
-    for(size_t i = bufferSize; i>0; --i,++bp )
+    if(isLogging_)
     {
-        execAndCheck(write(fd_,bp, 1) == 1, "EPP write to PP failed");
+        for(size_t i = 0; i<bufferSize; ++i)
+        {
+            logWrite(address, buffer[i]);
+        }
+    }
+}
+
+void ParallelPortEpp::writeByte(char byte)
+{
+    //Not addressed accesses are plain data line accesses (e.g. the printer/scanner switch sequence)
+    writeData(static_cast<unsigned char>(byte));
+}
+
+char ParallelPortEpp::readByte()
+{
+    return readData();
+}
+
+void ParallelPortEpp::readString(char * const buffer, size_t bufferSize)
+{
+    for(size_t i=0; i<bufferSize; ++i)
+    {
+        buffer[i] = readByte();
+    }
+}
+
+void ParallelPortEpp::writeString(char const*const buffer, size_t bufferSize)
+{
+    for(size_t i=0; i<bufferSize; ++i)
+    {
+        writeByte(buffer[i]);
     }
 }
 
 
 ParallelPortSpp::ParallelPortSpp(const std::string &device): ParallelPortBase(open(device.c_str(),O_RDWR))
 {
+    timing_.setSyscallCost(measureSyscallCost());
 }
 
-void ParallelPortSpp::writeByte(char addr, char byte)
+unsigned ParallelPortSpp::measureSyscallCost()
+{
+    //The fastest of a few writes of the idle control value is what every gap is guaranteed to get for free
+    const unsigned char idle = 0x04;
+    std::chrono::steady_clock::duration best = std::chrono::steady_clock::duration::max();
+
+    changeMode(IEEE1284_MODE_COMPAT);
+
+    for(unsigned i=0; i<64; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        execAndCheck(ioctl(fd_,PPWCONTROL,&idle), "Write control to PP failed");
+        auto duration = std::chrono::steady_clock::now() - start;
+
+        if(duration < best)
+        {
+            best = duration;
+        }
+    }
+
+    control_ = idle;
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(best).count();
+}
+
+void ParallelPortSpp::control(unsigned char value, BusTiming::Delay delay)
+{
+    timing_.wait(delay, writeControl(value));
+}
+
+void ParallelPortSpp::data(unsigned char value, BusTiming::Delay delay)
+{
+    timing_.wait(delay, writeData(value));
+}
+
+void ParallelPortSpp::addressCycle(char addr)
 {
     const unsigned char  low = 0x04;
     const unsigned char ahigh= 0x06;
-    const unsigned char dhigh= 0x05;
 
     changeMode(IEEE1284_MODE_COMPAT);
 
-    writeByte(addr);
-    udelay(1);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&low), "W-Low-1");
-    udelay(1);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&ahigh), "W-High-2");
-    udelay(4);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&low), "W-Low-3");
-    udelay(1);
-    writeByte(byte);
-    udelay(4);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&dhigh), "W-High-4");
-    udelay(1);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&low), "W-Low-5");
-    udelay(4);
+    data(addr, BusTiming::AddressSetup);
+    control(low, BusTiming::AddressSetup);
+    control(ahigh, BusTiming::AddressStrobe);
+    control(low, BusTiming::AddressHold);
+}
+
+void ParallelPortSpp::writeByte(char addr, char byte)
+{
+    const unsigned char  low = 0x04;
+    const unsigned char dhigh= 0x05;
+
+    addressCycle(addr);
+
+    data(byte, BusTiming::DataSetup);
+    control(dhigh, BusTiming::DataStrobe);
+    control(low, BusTiming::DataHold);
 
     logWrite(addr, byte);
 }
 
 char ParallelPortSpp::readByte(char addr)
 {
-
     const unsigned char olow = 0x04;
-    const unsigned char ohigh= 0x06;
     const unsigned char ilow = 0x04;//0x84;
     const unsigned char ihigh= 0x05;//0x85;
-    const int data_input = 1;
-    const int data_output = 0;
 
     char result;
 
-    changeMode(IEEE1284_MODE_COMPAT);
+    addressCycle(addr);
 
-    writeByte(addr);
-    udelay(1);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&olow), "R-Low-1");
-    udelay(1);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&ohigh), "R-High-2");
-    udelay(4);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&olow), "R-Low-3");
-    udelay(1);
-    execAndCheck(ioctl(fd_,PPDATADIR,&data_input), "R-Low-3");
-    execAndCheck(ioctl(fd_,PPWCONTROL,&ihigh), "R-Low-4");
-    udelay(4);
-    result = readByte();
-    execAndCheck(ioctl(fd_,PPWCONTROL,&ilow), "R-Low-5");
-    udelay(1);
-    execAndCheck(ioctl(fd_,PPDATADIR,&data_output), "R-Low-3");
-    execAndCheck(ioctl(fd_,PPWCONTROL,&olow), "R-Low-6");
-    udelay(1);
+    setDataDirection(true);
+    control(ihigh, BusTiming::ReadStrobe);
+    result = readData();
+    control(ilow, BusTiming::ReadHold);
+    setDataDirection(false);
+    control(olow, BusTiming::ReadHold);
 
     logRead(addr, result);
 
@@ -223,89 +500,202 @@ char ParallelPortSpp::readByte(char addr)
 void ParallelPortSpp::readString(char addr, char * const buffer, size_t bufferSize)
 {
     const unsigned char olow = 0x04;
-    const unsigned char ohigh= 0x06;
     const unsigned char ilow = 0x04;
     const unsigned char ihigh= 0x05;
 
-    const int data_input = 1;
-    const int data_output = 0;
-
-    changeMode(IEEE1284_MODE_COMPAT);
+    addressCycle(addr);
 
-    writeByte(addr);
-    udelay(1);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&olow), "R-Low-1");
-    udelay(1);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&ohigh), "R-High-2");
-    udelay(4);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&olow), "R-Low-3");
-    udelay(1);
-
-    execAndCheck(ioctl(fd_,PPDATADIR,&data_input), "R-Low-3");
+    setDataDirection(true);
 
     for(size_t i = 0; i<bufferSize; ++i)
     {
-        execAndCheck(ioctl(fd_,PPWCONTROL,&ihigh), "R-Low-4");
-        udelay(1);
-        buffer[i] = readByte();
-        execAndCheck(ioctl(fd_,PPWCONTROL,&ilow), "R-Low-5");
-        udelay(1);
+        control(ihigh, BusTiming::StreamReadStrobe);
+        buffer[i] = readData();
+        control(ilow, BusTiming::StreamReadHold);
         logRead(addr, buffer[i]);
     }
 
-    execAndCheck(ioctl(fd_,PPDATADIR,&data_output), "R-Low-3");
+    setDataDirection(false);
 
-    execAndCheck(ioctl(fd_,PPWCONTROL,&olow), "R-Low-6");
-    udelay(1);
+    control(olow, BusTiming::ReadHold);
 }
 
 void ParallelPortSpp::writeString(char addr, char const*const buffer, size_t bufferSize)
 {
+    //Data is strobed like in writeByte, 0x06 would latch every byte as an address
     const unsigned char low = 0x04;
-    const unsigned char ahigh= 0x06;
-    const unsigned char dhigh= 0x06;
-
-    changeMode(IEEE1284_MODE_COMPAT);
+    const unsigned char dhigh= 0x05;
 
-    writeByte(addr);
-    udelay(1);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&low), "W-Low-1");
-    udelay(1);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&ahigh), "W-High-2");
-    udelay(4);
-    execAndCheck(ioctl(fd_,PPWCONTROL,&low), "W-Low-3");
-    udelay(1);
+    addressCycle(addr);
 
     for(size_t i = 0; i<bufferSize; ++i )
     {
-        writeByte(buffer[i]);
-        udelay(4);
-        execAndCheck(ioctl(fd_,PPWCONTROL,&dhigh), "W-High-4");
-        udelay(1);
-        execAndCheck(ioctl(fd_,PPWCONTROL,&low), "W-Low-5");
-        udelay(4);
+        data(buffer[i], BusTiming::DataSetup);
+        control(dhigh, BusTiming::DataStrobe);
+        control(low, BusTiming::DataHold);
 
         logWrite(addr, buffer[i]);
     }
 }
 
-void  ParallelPortSpp::writeByte(char byte)
+void ParallelPortSpp::translate(BusProgram &program)
 {
-    const unsigned char c = static_cast<unsigned char>(byte);
+    //These are the same sequences as in writeByte(addr, byte) and readByte(addr)
+    const unsigned char  low = 0x04;
+    const unsigned char ahigh= 0x06;
+    const unsigned char dhigh= 0x05;
+    const unsigned char ihigh= 0x05;
 
-    changeMode(IEEE1284_MODE_COMPAT);
-    execAndCheck(ioctl(fd_,PPWDATA,&c), "Write to PP failed");
+    std::vector<BusProgram::Cycle> &cycles = program.cycles_;
+    int controlLines = UnknownState;
+    int dataLines = UnknownState;
+
+    cycles.clear();
+    program.skippedCycles_ = 0;
+
+    const int noDelay = -1;
+
+    auto append = [&](BusProgram::Cycle::Type type, unsigned char value, int delay, char *result)
+    {
+        //Accesses that do not change the lines are dropped, their delay is kept (without the syscall cost)
+        if((type == BusProgram::Cycle::WriteControl && controlLines == value) ||
+           (type == BusProgram::Cycle::WriteData && dataLines == value))
+        {
+            ++program.skippedCycles_;
+
+            if(!cycles.empty() && delay != noDelay)
+            {
+                cycles.back().delay_ += timing_.getEffective(BusTiming::Delay(delay), false);
+            }
+            return;
+        }
+
+        switch(type)
+        {
+        case BusProgram::Cycle::WriteControl: controlLines = value; break;
+        case BusProgram::Cycle::WriteData: dataLines = value; break;
+        case BusProgram::Cycle::DataInput:
+        case BusProgram::Cycle::DataOutput: dataLines = UnknownState; break;
+        default: break;
+        }
+
+        BusProgram::Cycle cycle;
+
+        cycle.type_ = type;
+        cycle.value_ = value;
+        cycle.delay_ = delay == noDelay ? 0 : timing_.getEffective(BusTiming::Delay(delay));
+        cycle.result_ = result;
+
+        cycles.push_back(cycle);
+    };
+
+    for(const BusProgram::Operation &operation : program.operations_)
+    {
+        append(BusProgram::Cycle::WriteData, operation.address_, BusTiming::AddressSetup, nullptr);
+        append(BusProgram::Cycle::WriteControl, low, BusTiming::AddressSetup, nullptr);
+        append(BusProgram::Cycle::WriteControl, ahigh, BusTiming::AddressStrobe, nullptr);
+        append(BusProgram::Cycle::WriteControl, low, BusTiming::AddressHold, nullptr);
+
+        if(operation.result_)
+        {
+            append(BusProgram::Cycle::DataInput, 0, noDelay, nullptr);
+            append(BusProgram::Cycle::WriteControl, ihigh, BusTiming::ReadStrobe, nullptr);
+            append(BusProgram::Cycle::ReadData, 0, noDelay, operation.result_);
+            append(BusProgram::Cycle::WriteControl, low, BusTiming::ReadHold, nullptr);
+            append(BusProgram::Cycle::DataOutput, 0, noDelay, nullptr);
+            append(BusProgram::Cycle::WriteControl, low, BusTiming::ReadHold, nullptr);
+        }else
+        {
+            append(BusProgram::Cycle::WriteData, operation.data_, BusTiming::DataSetup, nullptr);
+            append(BusProgram::Cycle::WriteControl, dhigh, BusTiming::DataStrobe, nullptr);
+            append(BusProgram::Cycle::WriteControl, low, BusTiming::DataHold, nullptr);
+        }
+    }
+
+    program.finalControl_ = controlLines;
+    program.finalData_ = dataLines;
+    program.translatedBy_ = this;
+    program.timingRevision_ = timingRevision_;
+    program.translated_ = true;
 }
 
-char  ParallelPortSpp::readByte()
+void ParallelPortSpp::execute(BusProgram &program)
 {
-    unsigned char c = 0;
+    if(program.operations_.empty())
+    {
+        return;
+    }
+
+    if(!program.translated_ || program.translatedBy_ != this || program.timingRevision_ != timingRevision_)
+    {
+        translate(program);
+    }
 
     changeMode(IEEE1284_MODE_COMPAT);
+    setDataDirection(false);
+
+    for(const BusProgram::Cycle &cycle : program.cycles_)
+    {
+        unsigned char value = cycle.value_;
+        int direction;
+
+        switch(cycle.type_)
+        {
+        case BusProgram::Cycle::WriteData:
+            execAndCheck(ioctl(fd_,PPWDATA,&value), "Write to PP failed");
+            break;
+        case BusProgram::Cycle::WriteControl:
+            execAndCheck(ioctl(fd_,PPWCONTROL,&value), "Write control to PP failed");
+            break;
+        case BusProgram::Cycle::ReadData:
+            execAndCheck(ioctl(fd_,PPRDATA,&value), "Read from PP failed");
+            *cycle.result_ = value;
+            break;
+        case BusProgram::Cycle::DataInput:
+            direction = 1;
+            execAndCheck(ioctl(fd_,PPDATADIR,&direction), "PP data direction change failed");
+            break;
+        case BusProgram::Cycle::DataOutput:
+            direction = 0;
+            execAndCheck(ioctl(fd_,PPDATADIR,&direction), "PP data direction change failed");
+            break;
+        }
+
+        BusTiming::spin(cycle.delay_);
+    }
+
+    ioctlStatistics_.issued_ += program.cycles_.size();
+    ioctlStatistics_.skipped_ += program.skippedCycles_;
+
+    control_ = program.finalControl_;
+    data_ = program.finalData_;
 
-    execAndCheck(ioctl(fd_,PPRDATA,&c), "Write to PP failed");
+    if(isLogging_)
+    {
+        for(const BusProgram::Operation &operation : program.operations_)
+        {
+            if(operation.result_)
+            {
+                logRead(operation.address_, *operation.result_);
+            }else
+            {
+                logWrite(operation.address_, operation.data_);
+            }
+        }
+    }
+}
+
+void  ParallelPortSpp::writeByte(char byte)
+{
+    changeMode(IEEE1284_MODE_COMPAT);
+    writeData(static_cast<unsigned char>(byte));
+}
+
+char  ParallelPortSpp::readByte()
+{
+    changeMode(IEEE1284_MODE_COMPAT);
 
-    return c;
+    return readData();
 }
 
 void  ParallelPortSpp::readString( char * const buffer, size_t bufferSize)
@@ -4,12 +4,87 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <string>
-#include <chrono>
-#include <fstream>
+#include <vector>
+
+#include "bustiming.hpp"
+#include "bustrace.hpp"
+
+class ParallelPortBase;
+
+/**
+ * @brief The BusProgram class is a list of addressed reads and writes that a port executes in one go.
+ *
+ * A program can be executed as often as needed. Ports are free to translate the operations into a
+ * cheaper representation on the first execution and reuse it until the program is modified.
+ */
+class BusProgram
+{
+public:
+    BusProgram();
+
+    void write(char address, char byte);
+    void read(char address, char *result);
+    void clear();
+
+    bool empty() const { return operations_.empty(); }
+    size_t size() const { return operations_.size(); }
+
+private:
+    friend class ParallelPortBase;
+    friend class ParallelPortSpp;
+
+    struct Operation
+    {
+        char address_;
+        char data_;
+        char *result_; ///< Destination of a read, nullptr for writes
+    };
+
+    /**
+     * @brief The Cycle struct is a single port access of a translated program
+     */
+    struct Cycle
+    {
+        enum Type
+        {
+            WriteData,
+            WriteControl,
+            ReadData,
+            DataInput,
+            DataOutput
+        };
+
+        uint8_t type_;
+        uint8_t value_;
+        uint32_t delay_; ///< Delay in ns after the access
+        char *result_;
+    };
+
+    std::vector<Operation> operations_;
+    std::vector<Cycle> cycles_;
+    const ParallelPortBase *translatedBy_;
+    unsigned timingRevision_; ///< Timing the cycles were translated with
+    uint64_t skippedCycles_; ///< Accesses removed while translating
+    int finalControl_;       ///< Control lines after the last cycle
+    int finalData_;          ///< Data lines after the last cycle
+    bool translated_;
+};
+
+/* ------------------------------------------------------------------------------------------*/
 
 class ParallelPortBase
 {
 public:
+    /**
+     * @brief The IoctlStatistics struct counts the ppdev ioctls that were issued and the ones
+     * that were skipped because the port was already in the requested state.
+     */
+    struct IoctlStatistics
+    {
+        uint64_t issued_;
+        uint64_t skipped_;
+    };
+
     ParallelPortBase(int fd);
     virtual ~ParallelPortBase();
 
@@ -23,24 +98,59 @@ public:
     virtual void readString( char * const buffer, size_t bufferSize) = 0;
     virtual void writeString( char const*const buffer, size_t bfferSize) = 0;
 
+    virtual void execute(BusProgram &program);
+
     void changeMode(int mode);
+    void invalidatePortState();
+
+    const BusTiming &getTiming() const { return timing_; }
+    void setTiming(const BusTiming &timing);
 
+    const IoctlStatistics &getIoctlStatistics() const { return ioctlStatistics_; }
+    void resetIoctlStatistics();
+
+    static ParallelPortBase *openPort(const std::string &device);
+    static std::string defaultDevice();
+
+    /**
+     * @brief setupLogFile opens a binary bus trace, use bustrace2txt to convert it for the logic analyser viewer
+     */
     void setupLogFile(const std::string &filename);
     void startLogging();
     void stopLogging();
 
 protected:
+    enum
+    {
+        UnknownState = -1
+    };
+
+    ParallelPortBase(); ///< For ports that are not backed by a ppdev device
+
     int fd_;
 
-    std::fstream logfile_;
+    int mode_;          ///< Last mode set with PPSETMODE
+    int dataDirection_; ///< Last direction set with PPDATADIR (0 = output, 1 = input)
+    int control_;       ///< Last value written with PPWCONTROL
+    int data_;          ///< Last value written with PPWDATA
+    IoctlStatistics ioctlStatistics_;
+
+    BusTiming timing_;
+    unsigned timingRevision_;
+
+    BusTraceRecorder trace_;
     bool isLogging_;
-    std::chrono::high_resolution_clock::time_point logStartTime_;
 
     void execAndCheck(int retValue, const std::string &message);
     void execAndCheck(bool retValue, const std::string &message);
 
-    void logRead(char address, char data);
-    void logWrite(char address, char data);
+    void setDataDirection(bool input);
+    bool writeControl(unsigned char control);
+    bool writeData(unsigned char data);
+    unsigned char readData();
+
+    void logRead(char address, char data) { if(isLogging_) trace_.record(address, data, false); }
+    void logWrite(char address, char data) { if(isLogging_) trace_.record(address, data, true); }
 
 };
 
@@ -50,11 +160,23 @@ class ParallelPortEpp: public ParallelPortBase
 {
 public:
     ParallelPortEpp(int fd);
+    ParallelPortEpp(const std::string &device);
 
     virtual void writeByte(char address, char byte);
     virtual char readByte(char address);
     virtual void readString(char address, char * const buffer, size_t bufferSize);
     virtual void writeString(char address, char const*const buffer, size_t bfferSize);
+
+    virtual void writeByte(char byte);
+    virtual char readByte();
+    virtual void readString( char * const buffer, size_t bufferSize);
+    virtual void writeString(char const*const buffer, size_t bufferSize);
+
+private:
+    void negotiateEpp();
+    void writeAddress(char address);
+    void readBlock(char *buffer, size_t bufferSize);
+    void writeBlock(char const *buffer, size_t bufferSize);
 };
 
 /* ------------------------------------------------------------------------------------------*/
@@ -74,6 +196,16 @@ public:
     virtual void readString( char * const buffer, size_t bufferSize);
     virtual void writeString(char const*const buffer, size_t bufferSize);
 
+    virtual void execute(BusProgram &program);
+
+private:
+    unsigned measureSyscallCost();
+
+    void control(unsigned char value, BusTiming::Delay delay);
+    void data(unsigned char value, BusTiming::Delay delay);
+    void addressCycle(char addr);
+
+    void translate(BusProgram &program);
 };
 
 #endif // PARALLELPORT_H
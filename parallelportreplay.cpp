@@ -0,0 +1,226 @@
+#include "parallelportreplay.hpp"
+
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+ParallelPortReplay::ParallelPortReplay(const std::string &filename, size_t lookAhead):
+    position_(0),
+    lookAhead_(lookAhead),
+    repeatedPolls_(0),
+    finished_(false)
+{
+    if(!BusTraceRecorder::load(filename, events_))
+    {
+        throw std::runtime_error("Failed to load the bus trace "+filename);
+    }
+
+    memset(lastRead_, 0xFF, sizeof(lastRead_));
+    memset(&statistics_, 0, sizeof(statistics_));
+
+    statistics_.recorded_ = events_.size();
+}
+
+ParallelPortReplay::~ParallelPortReplay()
+{
+    finish();
+    report(std::cerr);
+}
+
+bool ParallelPortReplay::matches(const BusTraceEvent &event, uint8_t address, uint8_t data, bool write) const
+{
+    if(event.address_ != address || ((event.flags_ & BusTraceEvent::Write) != 0) != write)
+    {
+        return false;
+    }
+
+    //Reads match on the address, the value is what the recording returns
+    return !write || event.data_ == data;
+}
+
+bool ParallelPortReplay::isRepeatedRead(size_t index) const
+{
+    if(index == 0 || index >= events_.size())
+    {
+        return false;
+    }
+
+    const BusTraceEvent &previous = events_[index-1];
+    const BusTraceEvent &event = events_[index];
+
+    return !(event.flags_ & BusTraceEvent::Write) && !(previous.flags_ & BusTraceEvent::Write) &&
+            event.address_ == previous.address_ && event.data_ == previous.data_;
+}
+
+void ParallelPortReplay::addDifference(const std::string &kind, uint8_t address, uint8_t data, bool write)
+{
+    if(differences_.size() < MaxDifferences)
+    {
+        std::stringstream text;
+
+        text<<kind<<" "<<(write ? "write " : "read ")<<std::hex<<std::setfill('0')<<std::setw(2)<<unsigned(address);
+
+        if(write)
+        {
+            text<<" = "<<std::setw(2)<<unsigned(data);
+        }
+
+        text<<std::dec<<" at access "<<statistics_.issued_<<" (trace event "<<position_<<")";
+
+        differences_.push_back(text.str());
+    }
+}
+
+uint8_t ParallelPortReplay::access(uint8_t address, uint8_t data, bool write)
+{
+    ++statistics_.issued_;
+
+    //The driver polls more often than the recording, repeat the last value. This is limited, otherwise
+    //a driver that waits for a value that never comes would be stuck on it instead of resynchronizing
+    if(!write && position_ > 0 && repeatedPolls_ < MaxRepeatedPolls &&
+            (position_ >= events_.size() || !matches(events_[position_], address, data, write)))
+    {
+        const BusTraceEvent &previous = events_[position_-1];
+
+        if(!(previous.flags_ & BusTraceEvent::Write) && previous.address_ == address)
+        {
+            ++repeatedPolls_;
+            ++statistics_.equivalent_;
+            return previous.data_;
+        }
+    }
+
+    repeatedPolls_ = 0;
+
+    //The driver polls less often than the recording, drop the repeated reads
+    while(position_ < events_.size() && !matches(events_[position_], address, data, write) && isRepeatedRead(position_))
+    {
+        ++statistics_.equivalent_;
+        ++position_;
+    }
+
+    const size_t end = std::min(events_.size(), position_ + lookAhead_);
+
+    for(size_t i = position_; i < end; ++i)
+    {
+        if(matches(events_[i], address, data, write))
+        {
+            for(; position_ < i; ++position_)
+            {
+                const BusTraceEvent &skipped = events_[position_];
+
+                if(!isRepeatedRead(position_))
+                {
+                    ++statistics_.missing_;
+                    addDifference("missing", skipped.address_, skipped.data_, skipped.flags_ & BusTraceEvent::Write);
+                }else
+                {
+                    ++statistics_.equivalent_;
+                }
+            }
+
+            ++statistics_.matched_;
+            ++position_;
+
+            if(!write)
+            {
+                lastRead_[address] = events_[i].data_;
+            }
+
+            return write ? data : events_[i].data_;
+        }
+    }
+
+    ++statistics_.extra_;
+    addDifference("extra", address, data, write);
+
+    return write ? data : lastRead_[address];
+}
+
+void ParallelPortReplay::finish()
+{
+    if(finished_)
+    {
+        return;
+    }
+
+    for(; position_ < events_.size(); ++position_)
+    {
+        const BusTraceEvent &skipped = events_[position_];
+
+        if(!isRepeatedRead(position_))
+        {
+            ++statistics_.missing_;
+            addDifference("missing", skipped.address_, skipped.data_, skipped.flags_ & BusTraceEvent::Write);
+        }
+    }
+
+    finished_ = true;
+}
+
+void ParallelPortReplay::report(std::ostream &stream) const
+{
+    stream<<std::dec<<"Recorded accesses:   "<<statistics_.recorded_<<std::endl;
+    stream<<"Issued accesses:     "<<statistics_.issued_<<std::endl;
+    stream<<"Matched:             "<<statistics_.matched_<<std::endl;
+    stream<<"Equivalent polls:    "<<statistics_.equivalent_<<std::endl;
+    stream<<"Extra:               "<<statistics_.extra_<<std::endl;
+    stream<<"Missing:             "<<statistics_.missing_<<std::endl;
+
+    for(const std::string &difference : differences_)
+    {
+        stream<<"  "<<difference<<std::endl;
+    }
+}
+
+void ParallelPortReplay::writeByte(char address, char byte)
+{
+    access(address, byte, true);
+    logWrite(address, byte);
+}
+
+char ParallelPortReplay::readByte(char address)
+{
+    char result = access(address, 0, false);
+
+    logRead(address, result);
+
+    return result;
+}
+
+void ParallelPortReplay::readString(char address, char * const buffer, size_t bufferSize)
+{
+    for(size_t i = 0; i < bufferSize; ++i)
+    {
+        buffer[i] = readByte(address);
+    }
+}
+
+void ParallelPortReplay::writeString(char address, char const*const buffer, size_t bufferSize)
+{
+    for(size_t i = 0; i < bufferSize; ++i)
+    {
+        writeByte(address, buffer[i]);
+    }
+}
+
+void ParallelPortReplay::writeByte(char)
+{
+}
+
+char ParallelPortReplay::readByte()
+{
+    return 0;
+}
+
+void ParallelPortReplay::readString(char * const buffer, size_t bufferSize)
+{
+    memset(buffer, 0, bufferSize);
+}
+
+void ParallelPortReplay::writeString(char const*const, size_t)
+{
+}
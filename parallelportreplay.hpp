@@ -0,0 +1,87 @@
+#ifndef PARALLELPORTREPLAY_H
+#define PARALLELPORTREPLAY_H
+
+#include "parallelport.hpp"
+#include "bustrace.hpp"
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The ParallelPortReplay class plays back a recorded bus trace instead of talking to a scanner.
+ *
+ * Reads return the values of the recording. Every access of the driver is compared with the trace:
+ * - identical accesses are consumed in order
+ * - repeated reads of the same value (e.g. status polls) are one access, the driver may issue them
+ *   more or less often than the recording
+ * - if the access does not match, the next events are searched for it. Skipped events are reported
+ *   as missing, an access that can not be found at all is reported as extra
+ *
+ * Only addressed accesses are recorded, the not addressed ones (printer/scanner switch) are ignored.
+ * The report is printed to std::cerr when the port is destroyed.
+ */
+class ParallelPortReplay: public ParallelPortBase
+{
+public:
+    struct Statistics
+    {
+        uint64_t recorded_;   ///< Accesses in the trace
+        uint64_t issued_;     ///< Addressed accesses issued by the driver
+        uint64_t matched_;    ///< Accesses that matched the trace
+        uint64_t equivalent_; ///< Repeated reads that were collapsed with the recorded ones
+        uint64_t extra_;      ///< Accesses the trace does not have
+        uint64_t missing_;    ///< Accesses of the trace the driver did not issue
+    };
+
+    ParallelPortReplay(const std::string &filename, size_t lookAhead = 256);
+    virtual ~ParallelPortReplay();
+
+    virtual void writeByte(char address, char byte);
+    virtual char readByte(char address);
+    virtual void readString(char address, char * const buffer, size_t bufferSize);
+    virtual void writeString(char address, char const*const buffer, size_t bufferSize);
+
+    virtual void writeByte(char byte);
+    virtual char readByte();
+    virtual void readString( char * const buffer, size_t bufferSize);
+    virtual void writeString(char const*const buffer, size_t bufferSize);
+
+    /**
+     * @brief finish counts the rest of the trace as missing, call it after the last access
+     */
+    void finish();
+
+    const Statistics &getStatistics() const { return statistics_; }
+    bool isEquivalent() const { return statistics_.extra_ == 0 && statistics_.missing_ == 0; }
+
+    /**
+     * @brief report prints the statistics and the first differences
+     */
+    void report(std::ostream &stream) const;
+
+private:
+    enum
+    {
+        MaxDifferences = 32,
+        MaxRepeatedPolls = 16
+    };
+
+    std::vector<BusTraceEvent> events_;
+    size_t position_;
+    size_t lookAhead_;
+    unsigned repeatedPolls_;
+    bool finished_;
+    uint8_t lastRead_[256];
+
+    Statistics statistics_;
+    std::vector<std::string> differences_;
+
+    uint8_t access(uint8_t address, uint8_t data, bool write);
+    bool matches(const BusTraceEvent &event, uint8_t address, uint8_t data, bool write) const;
+    bool isRepeatedRead(size_t index) const;
+    void addDifference(const std::string &kind, uint8_t address, uint8_t data, bool write);
+};
+
+#endif // PARALLELPORTREPLAY_H
@@ -3,5 +3,199 @@
 
 #include <stdint.h>
 
-#endif // REGISTER_HPP
+/**
+ * @brief Description of the A4S2600 registers and the fields in them.
+ *
+ * The ASIC has 64 registers. They are numbered by an index here, the address on the bus depends on the
+ * revision of the ASIC (see registerAddress). A field is a type that carries its register, position and
+ * width, an object of it carries the value, e.g.
+ *
+ *     asic.update(A4s2600Registers::CcdMode(true), A4s2600Registers::Dma(true));
+ *
+ * Fields spanning more than one register (counters, limits) are stored little endian in consecutive registers. They are
+ * written low byte first, except for the values the ASIC latches with the low byte (speed counter, black level), which
+ * are written high byte first like the driver always did, so the ASIC never runs with half of a new value.
+ */
+namespace A4s2600Registers
+{
+    enum Revision
+    {
+        RevisionA1 = 0xa1,
+        RevisionA2 = 0xa2,
+        RevisionA4 = 0xa4
+    };
+
+    enum
+    {
+        RegisterCount = 64
+    };
+
+    /**
+     * @brief registerAddress maps the register index to the address written to channel 6
+     *
+     * The a1 has the registers distributed over four banks (0x10, 0x20, 0x40, 0x80), the later revisions
+     * use the index as address.
+     */
+    constexpr unsigned registerAddress(unsigned revision, unsigned index)
+    {
+        return revision == RevisionA1 ? (0x10u << (index % 4)) + index / 4 : index;
+    }
+
+    template<unsigned Revision, unsigned Index>
+    struct RegisterAddress
+    {
+        static_assert(Index < RegisterCount, "The ASIC only has 64 registers");
+        enum { value = registerAddress(Revision, Index) };
+    };
+
+    /**
+     * @brief The Field struct is a group of bits inside one register
+     */
+    template<unsigned Index, unsigned Shift, unsigned Width = 1>
+    struct Field
+    {
+        static_assert(Index < RegisterCount, "The ASIC only has 64 registers");
+        static_assert(Width > 0 && Shift + Width <= 8, "A field has to fit into its register");
+
+        enum
+        {
+            index = Index,
+            bytes = 1,
+            highFirst = false,
+            shift = Shift,
+            mask = ((1u << Width) - 1) << Shift
+        };
+
+        explicit constexpr Field(unsigned value): value_(value) {}
+
+        constexpr uint8_t byte(unsigned) const { return (value_ << Shift) & mask; }
+
+        unsigned value_;
+    };
+
+    /**
+     * @brief The Value struct is a value occupying whole registers, the lowest byte is in the first one.
+     * With HighFirst the registers are written from the highest byte down.
+     */
+    template<unsigned Index, unsigned Bytes, bool HighFirst = false>
+    struct Value
+    {
+        static_assert(Bytes > 0 && Index + Bytes <= RegisterCount, "The ASIC only has 64 registers");
+
+        enum
+        {
+            index = Index,
+            bytes = Bytes,
+            highFirst = HighFirst,
+            shift = 0,
+            mask = 0xFF
+        };
+
+        explicit constexpr Value(unsigned value): value_(value) {}
+
+        constexpr uint8_t byte(unsigned i) const { return (value_ >> (8 * i)) & 0xFF; }
+
+        unsigned value_;
+    };
+
+    /**
+     * @brief Overlapping is true if two of the fields share a bit, such an update would be ambiguous
+     */
+    template<typename A, typename B>
+    struct Overlaps
+    {
+        enum
+        {
+            value = unsigned(A::index) < unsigned(B::index) + unsigned(B::bytes) &&
+                    unsigned(B::index) < unsigned(A::index) + unsigned(A::bytes) &&
+                    (unsigned(A::mask) & unsigned(B::mask)) != 0
+        };
+    };
+
+    template<typename... Fields>
+    struct Overlapping
+    {
+        enum { value = false };
+    };
+
+    template<typename First, typename... Rest>
+    struct Overlapping<First, Rest...>
+    {
+        template<typename... Others>
+        struct WithFirst
+        {
+            enum { value = false };
+        };
 
+        template<typename Other, typename... Others>
+        struct WithFirst<Other, Others...>
+        {
+            enum { value = Overlaps<First, Other>::value || WithFirst<Others...>::value };
+        };
+
+        enum { value = WithFirst<Rest...>::value || Overlapping<Rest...>::value };
+    };
+
+    /* Register 1 */
+    typedef Field<1, 7> FifoReset;          ///< Pulse to empty the FiFo
+
+    /* Register 5 */
+    typedef Field<5, 5> Sync;
+
+    /* Exposure time in clock ticks (1us) per color */
+    typedef Value<6, 2> ExposureRed;
+    typedef Value<8, 2> ExposureGreen;
+    typedef Value<10, 2> ExposureBlue;
+
+    /* Register 12 */
+    typedef Field<12, 0, 2> LedMode;        ///< 3 lets the LED blink with 6Hz
+
+    typedef Value<13, 1> TextThreshold;
+
+    /* Register 16 */
+    typedef Field<16, 1> LampOff;           ///< The lamp is low active
+    typedef Field<16, 2> DataRequest;
+    typedef Field<16, 3> Dma;
+    typedef Field<16, 4> CcdMode;
+    typedef Field<16, 6> TextMode;
+    typedef Field<16, 7> Calibration;       ///< Raw data, the pixel gain in the on chip memory is not applied
+
+    /* Black level of the a1 */
+    typedef Value<19, 2, true> BlackLevelEvenA1;
+    typedef Value<21, 1> BlackLevelStateA1;
+    typedef Value<33, 2, true> BlackLevelOddA1;
+
+    typedef Value<22, 2> ByteCount;         ///< Bytes per channel and line
+    typedef Value<24, 2, true> SpeedCounter;      ///< Motor speed, the step length is inverse to it
+
+    /* Register 26 */
+    typedef Field<26, 0, 3> ChannelDisable; ///< Bit 2 red, bit 1 green, bit 0 blue
+
+    /* Digital offset per color */
+    typedef Value<42, 1> DigitalOffsetRed;
+    typedef Value<44, 1> DigitalOffsetGreen;
+    typedef Value<46, 1> DigitalOffsetBlue;
+
+    /* Register 49 */
+    typedef Field<49, 1> AdFrequency9Mhz;   ///< Otherwise the AD converter runs with 6Mhz
+    typedef Field<49, 5> SerialEnable;      ///< Serial interface to the WM8144
+    typedef Field<49, 6> SerialClock;       ///< Pulse to latch the value shifted into the WM8144
+    typedef Field<49, 7> AdcTenBits;
+
+    /* Black level of the a2/a4 */
+    typedef Value<50, 2, true> BlackLevelOddA2;
+    typedef Value<52, 2, true> BlackLevelEvenA2;
+    typedef Value<63, 1> BlackLevelStateA2;
+
+    /* FiFo limits in bytes, they are reflected in the status bits 1 and 2 */
+    typedef Value<56, 3> UpperMemoryLimit;
+    typedef Value<59, 3> LowerMemoryLimit;
+
+    static_assert(RegisterAddress<RevisionA1, 16>::value == 0x14, "a1 register mapping");
+    static_assert(RegisterAddress<RevisionA1, 49>::value == 0x2C, "a1 register mapping");
+    static_assert(RegisterAddress<RevisionA2, 49>::value == 49, "a2 register mapping");
+    static_assert(!Overlapping<CcdMode, Dma, LampOff, Calibration>::value, "register 16 fields");
+    static_assert(Overlapping<ExposureGreen, Value<9, 1> >::value, "overlap check");
+}
+
+#endif // REGISTER_HPP
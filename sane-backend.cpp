@@ -3,7 +3,9 @@
 #include <iostream>
 #include <string>
 #include <functional>
+#include <memory>
 #include <string.h>
+#include <algorithm>
 
 #include "scannercontrol.hpp"
 #include "a4s2600.hpp"
@@ -34,8 +36,11 @@ static int setScanHeight(SaneDeviceHandle *, void*);
 static int getScanWidth(SaneDeviceHandle *, void*);
 static int setScanWidth(SaneDeviceHandle *, void*);
 
-static int getStart(SaneDeviceHandle *, void*);
-static int setStart(SaneDeviceHandle *, void*);
+static int getStartX(SaneDeviceHandle *, void*);
+static int setStartX(SaneDeviceHandle *, void*);
+
+static int getStartY(SaneDeviceHandle *, void*);
+static int setStartY(SaneDeviceHandle *, void*);
 
 static int getScanMode(SaneDeviceHandle *, void*);
 static int setScanMode(SaneDeviceHandle *, void*);
@@ -158,8 +163,8 @@ static MyOption OptionStartX =
             .range = &startXRange
         }
     },
-    .getterFunc_ = getStart,
-    .setterFunc_ = setStart
+    .getterFunc_ = getStartX,
+    .setterFunc_ = setStartX
 };
 
 static SANE_Range startYRange =
@@ -186,8 +191,8 @@ static MyOption OptionStartY =
             .range = &startYRange
         }
     },
-    .getterFunc_ = getStart,
-    .setterFunc_ = setStart
+    .getterFunc_ = getStartY,
+    .setterFunc_ = setStartY
 };
 
 static SANE_String_Const mode_list[] = {
@@ -289,12 +294,12 @@ SANE_Status EXPORT(get_devices) (const SANE_Device *** device_list,
 
     try
     {
-        ParallelPortSpp spp("/dev/parport0");
+        std::unique_ptr<ParallelPortBase> port(ParallelPortBase::openPort(ParallelPortBase::defaultDevice()));
 
-        ScannerControl::switchToScanner(spp);
+        ScannerControl::switchToScanner(*port);
         try
         {
-            A4s2600 asic(spp);
+            A4s2600 asic(*port);
 
             if(asic.getAsicRevision()== 0xa2)
             {
@@ -308,7 +313,7 @@ SANE_Status EXPORT(get_devices) (const SANE_Device *** device_list,
             std::cerr<<e.what()<<std::endl;
         }
 
-        ScannerControl::switchToPrinter(spp);
+        ScannerControl::switchToPrinter(*port);
     }catch(const std::exception &e)
     {
         std::cerr<<e.what()<<std::endl;
@@ -334,7 +339,7 @@ SANE_Status EXPORT(open) (SANE_String_Const name, SANE_Handle * h)
     {
         try
         {
-            *h = new SaneDeviceHandle("/dev/parport0"); //It is not good to hardcode this ... but for now it will work
+            *h = new SaneDeviceHandle(ParallelPortBase::defaultDevice());
         }catch(const std::exception &e)
         {
             std::cerr<<e.what()<<std::endl;
@@ -423,41 +428,86 @@ static int setScanHeight(SaneDeviceHandle *handle, void *v)
 {
     double i = *static_cast<SANE_Int*>(v)/10.0;
 
-    if(i>0 && i<29.8)
+    if(i>handle->getScanTopInMm()/10.0 && i<29.8)
     {
         handle->setImageHeightInCm(i);
     }else
     {
-        handle->setImageHeightInCm(29.7);
+        handle->setImageHeightInCm(std::max(handle->getScanTopInMm()/10.0 + 0.1, std::min(i, 29.7)));
         return SANE_INFO_RELOAD_PARAMS | SANE_INFO_INEXACT;
     }
 
     return SANE_INFO_RELOAD_PARAMS;
 }
 
-static int getScanWidth(SaneDeviceHandle *, void *v)
+static int getScanWidth(SaneDeviceHandle *handle, void *v)
 {
-    *static_cast<SANE_Int*>(v) = 225;
+    *static_cast<SANE_Int*>(v) = handle->getScanRightInMm();
     return 0;
 }
 
-static int getStart(SaneDeviceHandle *, void* v)
+static int getStartX(SaneDeviceHandle *handle, void* v)
 {
-    *static_cast<SANE_Int*>(v) = 0;
+    *static_cast<SANE_Int*>(v) = handle->getScanLeftInMm();
     return 0;
+}
+
+static int setStartX(SaneDeviceHandle *handle, void* v)
+{
+    SANE_Int i = *static_cast<SANE_Int*>(v);
 
+    //At least a mm has to be left of the window
+    if(i >= 0 && i < SANE_Int(handle->getScanRightInMm()))
+    {
+        handle->setScanLeftInMm(i);
+    }else
+    {
+        handle->setScanLeftInMm(std::max(0, std::min<SANE_Int>(i, handle->getScanRightInMm() - 1)));
+        return SANE_INFO_RELOAD_PARAMS | SANE_INFO_INEXACT;
+    }
+
+    return SANE_INFO_RELOAD_PARAMS;
+}
+
+static int getStartY(SaneDeviceHandle *handle, void* v)
+{
+    *static_cast<SANE_Int*>(v) = handle->getScanTopInMm();
+    return 0;
 }
 
-static int setStart(SaneDeviceHandle *, void*)
+static int setStartY(SaneDeviceHandle *handle, void* v)
 {
-    return SANE_INFO_RELOAD_PARAMS | SANE_INFO_INEXACT;
+    SANE_Int i = *static_cast<SANE_Int*>(v);
+
+    //At least a mm has to be left above the bottom edge
+    if(i >= 0 && i < handle->getImageHeightInCm() * 10)
+    {
+        handle->setScanTopInMm(i);
+    }else
+    {
+        handle->setScanTopInMm(std::max<SANE_Int>(0, std::min<SANE_Int>(i, handle->getImageHeightInCm() * 10 - 1)));
+        return SANE_INFO_RELOAD_PARAMS | SANE_INFO_INEXACT;
+    }
+
+    return SANE_INFO_RELOAD_PARAMS;
 }
 
 
 
-static int setScanWidth(SaneDeviceHandle *, void*)
+static int setScanWidth(SaneDeviceHandle *handle, void *v)
 {
-    return SANE_INFO_RELOAD_PARAMS | SANE_INFO_INEXACT;
+    SANE_Int i = *static_cast<SANE_Int*>(v);
+
+    if(i > SANE_Int(handle->getScanLeftInMm()) && i <= brXRange.max)
+    {
+        handle->setScanRightInMm(i);
+    }else
+    {
+        handle->setScanRightInMm(std::min<SANE_Int>(brXRange.max, std::max<SANE_Int>(i, handle->getScanLeftInMm() + 1)));
+        return SANE_INFO_RELOAD_PARAMS | SANE_INFO_INEXACT;
+    }
+
+    return SANE_INFO_RELOAD_PARAMS;
 }
 
 
@@ -551,7 +601,7 @@ SANE_Status EXPORT(get_parameters) (SANE_Handle h,SANE_Parameters * p)
             p->pixels_per_line = handle->getScanner().getImageWidth();
             p->format = SANE_FRAME_GRAY;
             p->last_frame = SANE_TRUE;
-            p->lines = handle->getScanner().getNumberOfLines(handle->getImageHeightInCm());
+            p->lines = handle->getScanner().getNumberOfLines(handle->getScanHeightInCm());
         }catch(const std::exception &e)
         {
             std::cerr<<e.what()<<std::endl;
@@ -576,6 +626,7 @@ SANE_Status EXPORT(start) (SANE_Handle h)
         }catch(const std::exception &e)
         {
             std::cerr<<e.what()<<std::endl;
+            static_cast<SaneDeviceHandle*>(h)->recoverFromError();
             return SANE_STATUS_IO_ERROR;
         }
 
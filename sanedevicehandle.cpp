@@ -1,37 +1,88 @@
 #include "sanedevicehandle.hpp"
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
 
 SaneDeviceHandle::SaneDeviceHandle(const std::string &devName):
     fifo_(nullptr),
-    paraport_(devName),
+    calibrationCache_(CalibrationCache::defaultFilename()),
+    paraport_(ParallelPortBase::openPort(devName)),
     asic_(nullptr),
     scanner_(nullptr),
     thread_(nullptr),
     bytesAvailable_(0),
     bytesRead_(0),
     imageHeightInCm_(5),
+    scanTopInMm_(0),
+    scanLeftInMm_(0),
+    scanRightInMm_(225),
     scanFinished_(true),
-    blocking_(true)
+    blocking_(true),
+    checkedDpi_(0),
+    checkedTime_(0)
 {
-    ScannerControl::switchToScanner(paraport_);
-    asic_ = new A4s2600(paraport_);
+    profile_.load(TransportProfile::defaultFilename());
+    tuned_.load(TransportProfile::tunedFilename());
+    calibrationCache_.load();
+
+    BusTiming timing = paraport_->getTiming();
+    timing.load(profile_);
+    paraport_->setTiming(timing);
+
+    const char *trace = getenv("SANE_SE12000P_TRACE");
+
+    if(trace)
+    {
+        paraport_->setupLogFile(trace);
+        paraport_->startLogging();
+    }
+
+    ScannerControl::switchToScanner(*paraport_);
+    asic_ = new A4s2600(*paraport_);
+
+    if(profile_.get("auto_tune_timing", 0))
+    {
+        //The timing found by an earlier auto tune is used as long as it still works
+        BusTiming tuned = timing;
+
+        tuned.load(tuned_);
+        paraport_->setTiming(tuned);
+
+        if(!tuned_.has(BusTiming::getName(BusTiming::ReadStrobe)) || !asic_->verifyBusTiming())
+        {
+            paraport_->setTiming(timing);
+            asic_->autoTuneBusTiming();
+            paraport_->getTiming().store(tuned_);
+
+            if(!tuned_.save(TransportProfile::tunedFilename()))
+            {
+                std::cerr<<"Failed to write the tuned transport values"<<std::endl;
+            }
+        }
+    }
+
     scanner_ = new ScannerControl(*asic_);
-}
+    scanner_->getFifoTuning().load(profile_);
+    scanner_->getFifoTuning().load(tuned_);
 
-SaneDeviceHandle::~SaneDeviceHandle()
-{
-    if(asic_)
+    if(profile_.get("asic_clocked_scan", 0))
     {
-        delete asic_;
+        scanner_->setMotorMode(ScannerControl::AsicClockedMotor);
     }
 
-    if(scanner_)
+    const char *shading = getenv("SANE_SE12000P_SHADING");
+
+    if(shading && std::string(shading) == "software")
     {
-        delete scanner_;
+        scanner_->setShadingMode(ScannerControl::SoftwareShading);
     }
+}
 
+SaneDeviceHandle::~SaneDeviceHandle()
+{
     if(thread_)
     {
         if(thread_->joinable())
@@ -41,17 +92,36 @@ SaneDeviceHandle::~SaneDeviceHandle()
         delete thread_;
     }
 
+    if(scanner_)
+    {
+        //Park the carriage, scans leave it where they ended
+        try
+        {
+            scanner_->moveToCalibrationPosition();
+        }catch(std::exception &e)
+        {
+            std::cerr<<"Failed to park the carriage: "<<e.what()<<std::endl;
+        }
+
+        delete scanner_;
+    }
+
+    if(asic_)
+    {
+        delete asic_;
+    }
+
     if(fifo_)
     {
         delete fifo_;
     }
 
-    ScannerControl::switchToPrinter(paraport_);
+    ScannerControl::switchToPrinter(*paraport_);
 }
 
-ParallelPortSpp &SaneDeviceHandle::getParaport()
+ParallelPortBase &SaneDeviceHandle::getParaport()
 {
-    return paraport_;
+    return *paraport_;
 }
 
 A4s2600 &SaneDeviceHandle::getAsic()
@@ -90,28 +160,88 @@ void SaneDeviceHandle::startScanning()
     scanFinished_ = false;
 
     unsigned dpi = scanner_->getDpi(); //Normally not required, but it is safer to assume that this is the best way to do it
-    scanner_->calibrateScanner();
+    calibrate(dpi);
     scanner_->setupResolution(dpi);
 
-    asic_->setCalibration(true); //The only way that the image is currently correctly acquired ... at least until the integrated image processing works
+    //Without the calibration bit the ASIC applies the uploaded pixel gain
+    asic_->setCalibration(scanner_->getShadingMode() == ScannerControl::SoftwareShading);
 
-    scanner_->moveToStartPosition();
+    scanner_->moveToStartPosition(scanTopInMm_ / 10.0);
 
     fifo_ = new PosixFiFo(); //Create a new Fifo
 
     thread_ = new std::thread(std::bind(&SaneDeviceHandle::runScan,this));
 }
 
+void SaneDeviceHandle::calibrate(unsigned dpi)
+{
+    const CalibrationCache::Key key = {asic_->getAsicRevision(), asic_->getHardwareFeatures(), dpi};
+    ScannerControl::Calibration calibration;
+    time_t created;
+
+    //A calibration measured or checked a short time ago stays loaded regardless of its age, every other one comes from the cache
+    const bool recent = dpi == checkedDpi_ &&
+                        time(nullptr) - checkedTime_ <= time_t(profile_.get("calibration_check_interval", 300));
+
+    if(recent || (calibrationCache_.find(key, calibration, created) &&
+                  time(nullptr) - created <= time_t(profile_.get("calibration_max_age", 3600))))
+    {
+        if(!recent)
+        {
+            scanner_->applyCalibration(calibration);
+        }
+
+        //The check runs before every scan, only a drift beyond the tolerance leads to a full calibration
+        if(scanner_->verifyCalibration(profile_.get("calibration_tolerance", 4)))
+        {
+            std::cerr<<(recent ? "Using the loaded calibration" : "Using the cached calibration")<<std::endl;
+            checkedDpi_ = dpi;
+            checkedTime_ = time(nullptr);
+            return;
+        }
+    }
+
+    scanner_->calibrateScanner();
+    checkedDpi_ = dpi;
+    checkedTime_ = time(nullptr);
+
+    calibrationCache_.store(key, scanner_->getCalibration());
+
+    if(!calibrationCache_.save())
+    {
+        std::cerr<<"Failed to write the calibration cache"<<std::endl;
+    }
+}
+
 void SaneDeviceHandle::runScan()
 {
-    unsigned height = scanner_->getNumberOfLines(imageHeightInCm_);
+    unsigned height = scanner_->getNumberOfLines(getScanHeightInCm());
     unsigned width = scanner_->getImageWidth();
 
-    scanner_->scanLinesGray(A4s2600::Green,height,true,*fifo_, true);
+    try
+    {
+        scanner_->scanLinesGray(A4s2600::Green,height,true,*fifo_, true);
+    }catch(const std::exception &e)
+    {
+        //The reader gets the end of the image instead of waiting forever
+        std::cerr<<"Scan failed: "<<e.what()<<std::endl;
+        fifo_->closeWriteFifo();
+        recoverFromError();
+        scanFinished_ = true;
+        return;
+    }
+
+    //The next scan starts with the throughput measured in this one
+    scanner_->getFifoTuning().store(tuned_);
+
+    if(!tuned_.save(TransportProfile::tunedFilename()))
+    {
+        std::cerr<<"Failed to write the tuned transport values"<<std::endl;
+    }
 
     asic_->setCalibration(false);
 
-    scanner_->gotoHomePos();
+    //The carriage stays where the scan ended, the next scan drives straight to its start line
 
     bytesAvailable_ = height * width * sizeof(uint8_t);
 
@@ -119,6 +249,18 @@ void SaneDeviceHandle::runScan()
     scanFinished_ = true;
 }
 
+void SaneDeviceHandle::recoverFromError()
+{
+    try
+    {
+        asic_->resyncRegisters();
+        asic_->stopFreeRunning(); //A scan in the ASIC clocked mode would otherwise keep the carriage moving
+    }catch(const std::exception &e)
+    {
+        std::cerr<<"Failed to write the ASIC registers again: "<<e.what()<<std::endl;
+    }
+}
+
 void SaneDeviceHandle::waitForFinishedScan()
 {
     if(thread_)
@@ -156,3 +298,29 @@ void SaneDeviceHandle::setImageHeightInCm(double imageHeightInCm)
 {
     imageHeightInCm_ = imageHeightInCm;
 }
+
+double SaneDeviceHandle::getScanHeightInCm() const
+{
+    return std::max(0.1, imageHeightInCm_ - scanTopInMm_ / 10.0);
+}
+
+void SaneDeviceHandle::setScanLeftInMm(unsigned left)
+{
+    scanLeftInMm_ = left;
+    updateScanWindow();
+}
+
+void SaneDeviceHandle::setScanRightInMm(unsigned right)
+{
+    scanRightInMm_ = right;
+    updateScanWindow();
+}
+
+void SaneDeviceHandle::updateScanWindow()
+{
+    //The CCD has 600 pixels per inch
+    const unsigned left = scanLeftInMm_ * 600 / 25.4;
+    const unsigned right = scanRightInMm_ * 600 / 25.4;
+
+    scanner_->setScanWindow(left, right > left ? right - left : 0);
+}
@@ -3,9 +3,12 @@
 
 #include "parallelport.hpp"
 #include "a4s2600.hpp"
+#include "calibrationcache.hpp"
 #include "scannercontrol.hpp"
 #include "posixfifo.hpp"
+#include "transportprofile.hpp"
 
+#include <memory>
 #include <thread>
 
 class SaneDeviceHandle
@@ -14,11 +17,16 @@ public:
     SaneDeviceHandle(const std::string &devName);
     ~SaneDeviceHandle();
 
-    ParallelPortSpp& getParaport();
+    ParallelPortBase& getParaport();
     A4s2600& getAsic();
     ScannerControl& getScanner();
 
     void startScanning();
+
+    /**
+     * @brief recoverFromError writes the ASIC registers again after a failed scan, the ASIC may not hold what the driver expects
+     */
+    void recoverFromError();
     size_t copyImagebuffer(uint8_t *buff, size_t bufferLength);
     bool copyFinished() const { return bytesAvailable_ == bytesRead_; }
     bool isScanFinished() const { return scanFinished_; }
@@ -28,22 +36,48 @@ public:
     bool getBlocking() const;
     void setBlocking(bool blocking);
 
+    /* Bottom edge of the scanned area (BR-Y) */
     double getImageHeightInCm() const;
     void setImageHeightInCm(double imageHeightInCm);
 
+    /* Top edge of the scanned area, the carriage moves there before the scan starts */
+    unsigned getScanTopInMm() const { return scanTopInMm_; }
+    void setScanTopInMm(unsigned top) { scanTopInMm_ = top; }
+
+    /**
+     * @brief getScanHeightInCm returns the height of the scanned area between the top and bottom edge
+     */
+    double getScanHeightInCm() const;
+
+    /* Left and right edge of the scanned area, the scanner only processes the columns in between */
+    unsigned getScanLeftInMm() const { return scanLeftInMm_; }
+    unsigned getScanRightInMm() const { return scanRightInMm_; }
+    void setScanLeftInMm(unsigned left);
+    void setScanRightInMm(unsigned right);
+
 private:
     PosixFiFo *fifo_;
-    ParallelPortSpp paraport_;
+    TransportProfile profile_;
+    TransportProfile tuned_; ///< Values the driver measured, kept in TransportProfile::tunedFilename()
+    CalibrationCache calibrationCache_;
+    std::unique_ptr<ParallelPortBase> paraport_; ///< Closed when the constructor throws, too
     A4s2600 *asic_;
     ScannerControl *scanner_;
     std::thread *thread_;
     size_t bytesAvailable_;
     size_t bytesRead_;
     double imageHeightInCm_;
+    unsigned scanTopInMm_;
+    unsigned scanLeftInMm_;
+    unsigned scanRightInMm_;
     bool scanFinished_;
     bool blocking_;
+    unsigned checkedDpi_;  ///< Resolution of the calibration that is loaded into the scanner
+    time_t checkedTime_;   ///< When that calibration was last measured or checked against the white strip
 
     void runScan();
+    void calibrate(unsigned dpi);
+    void updateScanWindow();
 };
 
 #endif // SANEDEVICEHANDLE_H
@@ -1,28 +1,71 @@
 #include "scannercontrol.hpp"
+#include "linestatistics.hpp"
 #include "parallelport.hpp"
 #include "posixfifo.hpp"
+#include <algorithm>
 #include <iostream>
+#include <math.h>
+#include <string.h>
 #include <vector>
 
 enum
 {
     CCdWidth = 5300,
+    MaskedPixels = 20, //The first pixels of the CCD never see light
+    BrightStart = 1000, //The pixels the analog gain is adjusted for
+    BrightEnd = 1200,
+    BrightTarget = 216,
+    MaxPgaGain = 31,
+    ExposuresPerMeasurement = 2,
+    ColorChannels = (1 << A4s2600::Red) | (1 << A4s2600::Green) | (1 << A4s2600::Blue),
+    ScanAreaStart = 256, //Lines from the home position to the top of the scan area
+    LinesPerSpeed = 32500, //A step moves the carriage by this divided by the speed counter in lines
+    MaxMoveLines = 16, //Longest step of positioning moves, reached by growing the step one line at a time
+    HomeApproach = 64, //Counted moves back home stop here and leave the rest to the home sensor
+    RehomeInterval = 10, //Counted returns before the home sensor is searched again
+    LampOffSettle = 500, //ms the CCFL keeps glowing after it is switched off
+    LampWarmUp = 2000, //ms until the CCFL is stable again after it is switched on
     BytePerChannel = 1,
     BytePerLine = CCdWidth * BytePerChannel
 };
 
 ScannerControl::ScannerControl(A4s2600 &asic):
-    asic_(asic)
+    asic_(asic),
+    position_(0),
+    homed_(false),
+    returnsSinceHoming_(0),
+    windowStart_(0),
+    windowWidth_(CCdWidth),
+    shadingMode_(HardwareShading),
+    motorMode_(HostClockedMotor)
 {
+    //The speed counter of every step length a move can use
+    for(unsigned lines=1; lines<=MaxMoveLines; ++lines)
+    {
+        moveSpeed_.push_back(LinesPerSpeed / lines);
+    }
+
+    for(ShadingCorrection &shading : shading_)
+    {
+        shading.setGain(std::vector<double>(CCdWidth, 1.0));
+    }
+
     initalSetupScanner();
-    gotoHomePos();
     setupResolution(300);
 }
 
 void ScannerControl::gotoHomePos()
 {
+    //A known position gets close to the sensor quickly, only the last part is searched
+    if(homed_ && position_ > HomeApproach)
+    {
+        moveTo(HomeApproach);
+    }
+
+    asic_.begin();
     asic_.setExposureLevel(10000);
     asic_.setSpeedCounter(5000); //10 Steps per clock
+    asic_.commit();
 
     asic_.setMotorDirection(A4s2600::MoveForward);
     asic_.enableMotor(true);
@@ -55,12 +98,87 @@ void ScannerControl::gotoHomePos()
         }
     }
 
+    asic_.setMotorDirection(A4s2600::MoveForward);
+    position_ = 0;
+    homed_ = true;
+    returnsSinceHoming_ = 0;
+}
+
+void ScannerControl::moveToCalibrationPosition()
+{
+    if(!homed_ || returnsSinceHoming_ >= RehomeInterval)
+    {
+        gotoHomePos();
+        return;
+    }
+
+    if(position_ != 0)
+    {
+        moveTo(0);
+        ++returnsSinceHoming_;
+
+        //The count is only trusted as long as the sensor agrees
+        if(!asic_.isAtHomePosition())
+        {
+            std::cerr<<"Lost the carriage position, searching the home position again"<<std::endl;
+            homed_ = false;
+            gotoHomePos();
+        }
+    }
+}
+
+void ScannerControl::planMove(unsigned distance, std::vector<unsigned> &steps)
+{
+    unsigned step = 0;
+
+    steps.clear();
+
+    //A step can only be taken if the rest of the distance still allows to slow down to a single line
+    while(distance > 0)
+    {
+        if(step < MaxMoveLines && distance >= (step + 1) * (step + 2) / 2)
+        {
+            ++step;
+        } else if(distance < step * (step + 1) / 2)
+        {
+            step = std::max(1u, step - 1);
+        }
+
+        steps.push_back(step);
+        distance -= step;
+    }
+}
+
+void ScannerControl::moveTo(unsigned line)
+{
+    const bool forward = line > position_;
+    std::vector<unsigned> steps;
+
+    planMove(forward ? line - position_ : position_ - line, steps);
+
+    asic_.setMotorDirection(forward ? A4s2600::MoveForward : A4s2600::MoveBackward);
+    asic_.enableMotor(true);
+
+    for(unsigned lines : steps)
+    {
+        asic_.waitForClockChange(2);
+
+        //Speed and step reach the ASIC in one go, while cruising the speed counter is not written at all
+        asic_.begin();
+        asic_.setSpeedCounter(moveSpeed_[lines - 1]);
+        asic_.enableMove(true);
+        asic_.commit();
+
+        position_ = forward ? position_ + lines : position_ - lines;
+    }
+
     asic_.setMotorDirection(A4s2600::MoveForward);
 }
 
 void ScannerControl::initalSetupScanner()
 {
     std::cerr << "ASIC Revision:"<<std::hex<<asic_.getAsicRevision() <<std::endl;
+    asic_.begin();
     asic_.setCCDMode(false);
     asic_.setDMA(false);
     asic_.enableSync(true);
@@ -73,9 +191,8 @@ void ScannerControl::initalSetupScanner()
     asic_.enableChannel(A4s2600::AllChannels);
     asic_.selectAdFrequency(false);
     asic_.setByteCount(BytePerLine);
-    asic_.setLowerMemoryLimit(100);
-    asic_.setUpperMemoryLimit(20*BytePerLine);
     asic_.setExposureLevel(10000);
+    asic_.commit();
 }
 
 void ScannerControl::setupResolution(unsigned dpi)
@@ -92,36 +209,37 @@ void ScannerControl::setupResolution(unsigned dpi)
     }
 
     motorSpeed_ = motorSpeed_ / multiplyer_;
+
+    for(ShadingCorrection &shading : shading_)
+    {
+        shading.setDecimation(multiplyer_);
+    }
 }
 
-int ScannerControl::getDpi()
+unsigned ScannerControl::getCcdWidth()
 {
-    return 600 / multiplyer_;
+    return CCdWidth;
 }
 
-unsigned ScannerControl::getBlackTotal(const Line &line)
+int ScannerControl::getDpi()
 {
-    unsigned sum = 0;
-
-    for(unsigned i = 0; i< 20; ++i)
-    {
-        sum += line[i];
-    }
-
-    return sum;
+    return 600 / multiplyer_;
 }
 
-void ScannerControl::moveToStartPosition()
+void ScannerControl::moveToStartPosition(double topInCm)
 {
-    asic_.setSpeedCounter(8125); //10 Steps per clock
-    asic_.setMotorDirection(A4s2600::MoveForward);
+    const unsigned target = ScanAreaStart + unsigned(topInCm / 2.54 * 600 + 0.5);
 
-    for(unsigned i=0; i<64; ++i)
+    //Drives straight from wherever the last scan ended, the home sensor is only searched now and then
+    if(!homed_ || (position_ > target && returnsSinceHoming_ >= RehomeInterval))
     {
-        asic_.waitForClockChange(2);
-        asic_.enableMove(true);
+        gotoHomePos();
+    }else if(position_ > target)
+    {
+        ++returnsSinceHoming_;
     }
 
+    moveTo(target);
 }
 
 unsigned ScannerControl::getNumberOfLines(double sizeInCm)
@@ -130,239 +248,507 @@ unsigned ScannerControl::getNumberOfLines(double sizeInCm)
     return 600 * sizeInInch / multiplyer_ ;
 }
 
-unsigned ScannerControl::getBrightSum(const Line &line)
-{
-    unsigned sum = 0;
-
-    for(unsigned i = 1000; i<1200; ++i)
-    {
-        sum += line[i];
-    }
-
-    return sum;
-}
-
-unsigned ScannerControl::adjustAnalogOffset(A4s2600::Channel channel)
+void ScannerControl::adjustAnalogOffset(unsigned channels, unsigned offset[3])
 {
-   Line temporaryBuffer;
-   temporaryBuffer.resize(BytePerLine);
+   Measurement measurement;
 
    unsigned mask = 0x80;
-   unsigned offset = 0;
-   unsigned min = 255*20;
-   unsigned total = 0;
+   unsigned min[3];
 
-   while(mask!= 0x0)
+   for(unsigned channel=0; channel<3; ++channel)
    {
-       unsigned newOffset = offset | mask;
-       asic_.getWm8144().setPGAOffset(asic_.getWmChannel(channel),newOffset);
-       scanLinesGray(channel,1,false,&temporaryBuffer[0],temporaryBuffer.size());
-
-       total = getBlackTotal(temporaryBuffer);
+       offset[channel] = 0;
+       min[channel] = 255*20;
+   }
 
-       if(total > 20) //Half of all pixel are 1 the rest is 0
+   //The binary search runs for all channels at once, every step is one shared measurement
+   while(mask!= 0x0)
+   {
+       asic_.begin();
+       for(unsigned channel=0; channel<3; ++channel)
        {
-           offset = newOffset;
+           if(channels & (1 << channel))
+           {
+               asic_.getWm8144().setPGAOffset(asic_.getWmChannel(A4s2600::Channel(channel)),offset[channel] | mask);
+           }
        }
+       asic_.commit();
+
+       //Only the masked pixels are needed
+       measure(channels, MaskedPixels, ExposuresPerMeasurement, measurement);
 
-       if(total < min)
+       for(unsigned channel=0; channel<3; ++channel)
        {
-           min = total;
+           if(!(channels & (1 << channel)))
+           {
+               continue;
+           }
+
+           unsigned total = 0;
+           for(uint16_t value : measurement.sum_[channel])
+           {
+               total += value;
+           }
+           total /= ExposuresPerMeasurement;
+
+           if(total > 20) //Half of all pixel are 1 the rest is 0
+           {
+               offset[channel] |= mask;
+           }
+
+           if(total < min[channel])
+           {
+               min[channel] = total;
+           }
        }
 
        mask >>= 1;
    }
 
-   std::cerr<<" Min Black: "<<min<<std::endl;
-
-   return offset;
+   //The last trial is not necessarily the offset that was found
+   asic_.begin();
+   for(unsigned channel=0; channel<3; ++channel)
+   {
+       if(channels & (1 << channel))
+       {
+           std::cerr<<"Channel "<<channel<<" Min Black: "<<min[channel]<<std::endl;
+           asic_.getWm8144().setPGAOffset(asic_.getWmChannel(A4s2600::Channel(channel)),offset[channel]);
+       }
+   }
+   asic_.commit();
 }
 
 
-void ScannerControl::adjustOffset(A4s2600::Channel channel)
+void ScannerControl::adjustOffset(unsigned channels)
 {
-    unsigned digitalOffset = 4;
-    bool success = false;
-    unsigned analogOffset = 0;
+    unsigned digitalOffset[3] = {4, 4, 4};
+    unsigned analogOffset[3];
 
-    while(!success)
+    //Channels that run out of analog offset repeat the search with a higher digital offset
+    while(channels)
     {
-        asic_.setDigitalOffset(channel, digitalOffset);
-        analogOffset = adjustAnalogOffset(channel);
-        std::cerr<<"DOffset: "<<digitalOffset<<std::endl;
-        if(analogOffset == 255)
+        asic_.begin();
+        for(unsigned channel=0; channel<3; ++channel)
         {
-            digitalOffset += 4;
-        }else
+            if(channels & (1 << channel))
+            {
+                asic_.setDigitalOffset(A4s2600::Channel(channel), digitalOffset[channel]);
+            }
+        }
+        asic_.commit();
+
+        adjustAnalogOffset(channels, analogOffset);
+
+        for(unsigned channel=0; channel<3; ++channel)
         {
-            success = true;
+            if(!(channels & (1 << channel)))
+            {
+                continue;
+            }
+
+            std::cerr<<"Channel "<<channel<<" DOffset: "<<digitalOffset[channel]<<std::endl;
+
+            if(analogOffset[channel] == 255)
+            {
+                digitalOffset[channel] += 4;
+            }else
+            {
+                calibration_.channels_[channel].digitalOffset_ = digitalOffset[channel];
+                calibration_.channels_[channel].pgaOffset_ = analogOffset[channel];
+                channels &= ~(1 << channel);
+            }
         }
     }
 }
 
 
-void ScannerControl::adjustAnalogGain(A4s2600::Channel channel)
+void ScannerControl::measureBrightness(unsigned channels, const unsigned gain[3], double brightness[3])
 {
-    unsigned sum;
-    Line temporaryBuffer;
-    temporaryBuffer.resize(BytePerLine);
-    unsigned gain = 2;
+    Measurement measurement;
+
+    asic_.begin();
+    for(unsigned channel=0; channel<3; ++channel)
+    {
+        if(channels & (1 << channel))
+        {
+            asic_.getWm8144().setPGAGain(asic_.getWmChannel(A4s2600::Channel(channel)),gain[channel]);
+        }
+    }
+    asic_.commit();
+
+    measure(channels, BrightEnd, ExposuresPerMeasurement, measurement);
+
+    for(unsigned channel=0; channel<3; ++channel)
+    {
+        if(channels & (1 << channel))
+        {
+            unsigned total = 0;
+
+            for(unsigned i = BrightStart; i<BrightEnd; ++i)
+            {
+                total += measurement.sum_[channel][i];
+            }
 
-    do
+            brightness[channel] = double(total) / ((BrightEnd - BrightStart) * ExposuresPerMeasurement);
+        }
+    }
+}
+
+void ScannerControl::adjustAnalogGain(unsigned channels)
+{
+    //The brightness grows linearly with the PGA gain, two measurements give the line the target is estimated from
+    const unsigned firstGain = 2;
+    const unsigned secondGain = 6;
+    unsigned gain[3] = {firstGain, firstGain, firstGain};
+    unsigned secondGains[3] = {secondGain, secondGain, secondGain};
+    double brightness[3];
+    double second[3];
+    unsigned dark = 0;
+
+    measureBrightness(channels, gain, brightness);
+
+    for(unsigned channel=0; channel<3; ++channel)
     {
-        asic_.getWm8144().setPGAGain(asic_.getWmChannel(channel),gain);
-        scanLinesGray(channel,1,false,&temporaryBuffer[0],temporaryBuffer.size());
-        sum = getBrightSum(temporaryBuffer);
+        if((channels & (1 << channel)) && brightness[channel] < BrightTarget)
+        {
+            dark |= 1 << channel;
+        }
+    }
 
-        if(sum<216*200)
+    if(dark)
+    {
+        measureBrightness(dark, secondGains, second);
+
+        for(unsigned channel=0; channel<3; ++channel)
         {
-            gain+=1;
+            if(dark & (1 << channel))
+            {
+                const double slope = (second[channel] - brightness[channel]) / (secondGain - firstGain);
+
+                gain[channel] = MaxPgaGain;
+
+                if(slope > 0)
+                {
+                    gain[channel] = std::min<double>(MaxPgaGain, std::max<double>(firstGain, ceil(firstGain + (BrightTarget - brightness[channel]) / slope)));
+                }
+            }
+        }
+
+        //The estimate is usually right, otherwise the channels that are still too dark continue in single steps
+        while(dark)
+        {
+            measureBrightness(dark, gain, brightness);
+
+            for(unsigned channel=0; channel<3; ++channel)
+            {
+                if(dark & (1 << channel))
+                {
+                    if(brightness[channel] < BrightTarget && gain[channel] < MaxPgaGain)
+                    {
+                        ++gain[channel];
+                    }else
+                    {
+                        dark &= ~(1 << channel);
+                    }
+                }
+            }
         }
+    }
 
-    }while(sum<216*200);
+    for(unsigned channel=0; channel<3; ++channel)
+    {
+        if(channels & (1 << channel))
+        {
+            calibration_.channels_[channel].pgaGain_ = gain[channel];
+        }
+    }
 }
 
 void ScannerControl::calibrateScanner()
 {
+    calibration_ = Calibration();
+
+    moveToCalibrationPosition();
+
     /* Reset the Settings in the WM Controller*/
+    asic_.begin();
     asic_.getWm8144().setPGAGain(Wm8144::ChannelAll,2);
     asic_.getWm8144().setPGAOffset(Wm8144::ChannelAll,127);
     asic_.getWm8144().setPixelGain(Wm8144::ChannelAll,2000);
     asic_.getWm8144().setPixelOffset(Wm8144::ChannelAll,0);
 
     asic_.setCalibration(true);
+    asic_.commit();
 
-  //  adjustOffset(A4s2600::Red); adjustAnalogGain(A4s2600::Red); adjustOffset(A4s2600::Red);
-    adjustOffset(A4s2600::Green); adjustAnalogGain(A4s2600::Green); adjustOffset(A4s2600::Green);
-//    adjustOffset(A4s2600::Blue); adjustAnalogGain(A4s2600::Blue); adjustOffset(A4s2600::Blue);
+    //The channels are calibrated in lockstep, every measurement exposes all of them
+    adjustOffset(ColorChannels); adjustAnalogGain(ColorChannels); adjustOffset(ColorChannels);
 
- //   compensatePixelNonuniformity(A4s2600::Red);
-    compensatePixelNonuniformity(A4s2600::Green);
-//    compensatePixelNonuniformity(A4s2600::Blue);
+    compensatePixelNonuniformity(ColorChannels);
 
     asic_.setCalibration(false);
 }
 
-void ScannerControl::compensatePixelNonuniformity(A4s2600::Channel channel)
+void ScannerControl::applyCalibration(const Calibration &calibration)
 {
-    Line maxBuffer;
-    Line temporaryBuffer;
+    for(const ChannelCalibration &values : calibration.channels_)
+    {
+        if(values.valid_ && (values.white_.size() != CCdWidth || values.dark_.size() != CCdWidth))
+        {
+            throw std::runtime_error("The calibration does not match the CCD width");
+        }
+    }
 
-    maxBuffer.resize(BytePerLine);
-    temporaryBuffer.resize(BytePerLine);
-    for(unsigned int j=0; j<maxBuffer.size(); ++j)
+    calibration_ = calibration;
+
+    asic_.begin();
+    asic_.getWm8144().setPixelGain(Wm8144::ChannelAll,2000);
+    asic_.getWm8144().setPixelOffset(Wm8144::ChannelAll,0);
+
+    for(unsigned channel=0; channel<3; ++channel)
     {
-        maxBuffer[j] = 1;
+        const ChannelCalibration &values = calibration_.channels_[channel];
+
+        if(values.valid_)
+        {
+            asic_.setDigitalOffset(A4s2600::Channel(channel), values.digitalOffset_);
+            asic_.getWm8144().setPGAGain(Wm8144::ColorChannels(channel), values.pgaGain_);
+            asic_.getWm8144().setPGAOffset(Wm8144::ColorChannels(channel), values.pgaOffset_);
+        }
     }
 
-    for(unsigned int i=0; i<4; ++i)
+    asic_.commit();
+
+    for(unsigned channel=0; channel<3; ++channel)
     {
-        scanLinesGray(channel,1,false,&temporaryBuffer[0],temporaryBuffer.size());
+        if(calibration_.channels_[channel].valid_)
+        {
+            updateShading(A4s2600::Channel(channel));
+        }
+    }
+}
 
-        for(unsigned int j=0; j<maxBuffer.size(); ++j)
+bool ScannerControl::verifyCalibration(unsigned tolerance)
+{
+    Measurement measurement;
+    unsigned channels = 0;
+    bool success = true;
+
+    moveToCalibrationPosition();
+
+    for(unsigned channel=0; channel<3; ++channel)
+    {
+        if(calibration_.channels_[channel].valid_)
         {
-            if(temporaryBuffer[j] > maxBuffer[j])
-                maxBuffer[j] = temporaryBuffer[j];
+            channels |= 1 << channel;
         }
     }
 
-    for(unsigned int j=0; j<maxBuffer.size(); ++j)
+    if(!channels)
     {
-        perPixelGain[channel][j] = 255.0 / maxBuffer[j];
-        if(perPixelGain[channel][j] > 2)
+        return false;
+    }
+
+    asic_.setCalibration(true);
+    measure(channels, BytePerLine, 1, measurement);
+    asic_.setCalibration(false);
+
+    for(unsigned channel=0; channel<3 && success; ++channel)
+    {
+        const ChannelCalibration &values = calibration_.channels_[channel];
+        const Line &line = measurement.maximum_[channel];
+
+        if(!values.valid_)
+        {
+            continue;
+        }
+
+        //The average of the white strip and of the masked pixels have to be where they were during the calibration
+        const size_t exposed = line.size() - MaskedPixels;
+        const double white = double(LineStatistics::sum(&line[MaskedPixels], exposed)) / exposed;
+        const double expectedWhite = double(LineStatistics::sum(&values.white_[MaskedPixels], exposed)) / exposed;
+        const double black = double(LineStatistics::sum(&line[0], MaskedPixels)) / MaskedPixels;
+        const double expectedBlack = double(LineStatistics::sum(&values.dark_[0], MaskedPixels)) / MaskedPixels;
+
+        std::cerr<<"Calibration check: white "<<white<<" ("<<expectedWhite<<") black "<<black<<" ("<<expectedBlack<<")"<<std::endl;
+
+        success = fabs(white - expectedWhite) <= tolerance && fabs(black - expectedBlack) <= tolerance;
+    }
+
+    return success;
+}
+
+void ScannerControl::compensatePixelNonuniformity(unsigned channels)
+{
+    Measurement white;
+    Measurement dark;
+    const unsigned lines = 4;
+
+    measure(channels, BytePerLine, lines, white);
+
+    asic_.setLamp(false);
+    waitForLamp(LampOffSettle);
+    measure(channels, BytePerLine, lines, dark);
+    asic_.setLamp(true);
+    waitForLamp(LampWarmUp);
+
+    for(unsigned channel=0; channel<3; ++channel)
+    {
+        if(!(channels & (1 << channel)))
+        {
+            continue;
+        }
+
+        ChannelCalibration &calibration = calibration_.channels_[channel];
+        const std::vector<uint16_t> &sum = dark.sum_[channel];
+
+        calibration.white_ = white.maximum_[channel];
+        calibration.dark_.resize(BytePerLine);
+
+        for(unsigned int j=0; j<sum.size(); ++j)
         {
-            perPixelGain[channel][j] = 2.0;
+            calibration.dark_[j] = (sum[j] + lines / 2) / lines;
         }
+
+        calibration.valid_ = true;
+
+        updateShading(A4s2600::Channel(channel));
     }
+}
+
+void ScannerControl::waitForLamp(unsigned ms)
+{
+    //Counted in clock periods like every other wait, the exposure level is the period in us
+    const unsigned periods = ms * 1000 / std::max(1u, asic_.getCurrentExposureLevel());
+
+    asic_.waitForClockPulse(std::max(1u, periods));
+}
+
+void ScannerControl::updateShading(A4s2600::Channel channel)
+{
+    const Line &maxBuffer = calibration_.channels_[channel].white_;
+    Line darkBuffer = calibration_.channels_[channel].dark_;
+    Line asicGain(maxBuffer.size());
+    std::vector<double> gain(maxBuffer.size());
 
-#if 0
     for(unsigned int j=0; j<maxBuffer.size(); ++j)
     {
-        unsigned int tmp = ((255 - maxBuffer[j]) * 255) / maxBuffer[j]; //Compute the gain in integer math
+        //The white level above the dark level is stretched to 255
+        unsigned white = maxBuffer[j] > darkBuffer[j] ? maxBuffer[j] - darkBuffer[j] : 1;
+
+        unsigned int tmp = ((255 - white) * 255) / white; //Compute the gain in integer math
         if(tmp > 0xFF)
         {
             tmp = 0xFF;
         }
 
-        maxBuffer[j] = tmp;
+        //The ASIC multiplies with 1 + gain/255
+        asicGain[j] = tmp;
+        gain[j] = shadingMode_ == HardwareShading ? 1.0 + tmp / 255.0 : std::min(2.0, 255.0 / white);
     }
 
-    asic_.uploadPixelGain(channel, &maxBuffer[0], temporaryBuffer.size());
-#endif
+    if(shadingMode_ == HardwareShading)
+    {
+        //The ASIC applies the gain to the dark level as well, (pixel - dark) * gain is pixel * gain - dark * gain
+        for(unsigned int j=0; j<maxBuffer.size(); ++j)
+        {
+            darkBuffer[j] = std::min(255.0, ceil(darkBuffer[j] * gain[j]));
+            gain[j] = 1.0;
+        }
+    }else
+    {
+        //A zero gain leaves the data alone
+        std::fill(asicGain.begin(), asicGain.end(), 0);
+    }
+
+    shading_[channel].setGain(gain);
+    shading_[channel].setDark(darkBuffer);
+
+    asic_.uploadPixelGain(channel, &asicGain[0], asicGain.size());
 }
 
-void ScannerControl::scanLinesGray(A4s2600::Channel channel,
-                                   unsigned numberOfLines,
-                                   bool moveWhileScanning,
-                                   PosixFiFo &fifo,
-                                   bool enableCalibration)
+void ScannerControl::measure(unsigned channels, size_t pixels, unsigned exposures, Measurement &result)
 {
-    unsigned scannedLines = 0;
-    unsigned readLines = 0;
-    asic_.setSpeedCounter(motorSpeed_);
-    asic_.resetFiFo();
+    Line temporaryBuffer;
+    unsigned count = 0;
 
+    for(unsigned channel=0; channel<3; ++channel)
+    {
+        if(channels & (1 << channel))
+        {
+            result.sum_[channel].assign(pixels, 0);
+            result.maximum_[channel].assign(pixels, 0);
+            ++count;
+        }
+    }
+
+    temporaryBuffer.resize(pixels * count);
+
+    //The ASIC only captures the first pixels of every line, the lower limit tells when a whole one is in the FIFO
+    asic_.begin();
+    asic_.setByteCount(pixels);
+    asic_.setLowerMemoryLimit(pixels - 1);
+    asic_.setSpeedCounter(motorSpeed_);
     asic_.setCCDMode(true);
     asic_.setDMA(true);
+    asic_.commit();
 
-    std::vector<uint8_t> line;
-    line.resize(BytePerLine);
-
-    while(scannedLines < numberOfLines)
+    for(unsigned i=0; i<exposures; ++i)
     {
-        do
-        {
-            if(moveWhileScanning)
-            {
-                asic_.waitForClockChange(2);
-            }
-            asic_.sendChannelData(channel);
-            if(moveWhileScanning)
-            {
-                asic_.enableMove(true);
-            }else
-            {
-                asic_.waitForChannelTransferedToFiFo(channel);
-            }
-            ++scannedLines;
-        }while(scannedLines % 20 != 0 && scannedLines < numberOfLines);
+        asic_.resetFiFo();
+
+        uint8_t *line = &temporaryBuffer[0];
 
+        //All channels see the same exposure. A channel is only requested once the line of the one before is read.
+        //The short lines can be done before waitForChannelTransferedToFiFo sees them start, the FIFO level can not be missed
         asic_.setDataRequest(true);
 
-        do
+        for(unsigned channel=0; channel<3; ++channel)
         {
-            asic_.aquireImageData(&line[0],line.size());
-
-            if(enableCalibration)
+            if(channels & (1 << channel))
             {
-                for(unsigned int i=0; i<5300/multiplyer_; ++i)
-                {
-                    double tmp = line[i*multiplyer_]*perPixelGain[channel][i*multiplyer_];
-                    if(tmp >= 256)
-                    {
-                        tmp = 255;
-                    }
-
-                    line[i] = (uint8_t)tmp;
-                }
+                asic_.sendChannelData(A4s2600::Channel(channel));
+                asic_.waitForFifoAboveLowerLimit();
+                asic_.aquireImageData(line, pixels);
+                line += pixels;
             }
+        }
 
-            fifo.write(&line[0], 5300/multiplyer_);
+        asic_.setDataRequest(false);
 
-            ++readLines;
-        }while(readLines != scannedLines);
+        line = &temporaryBuffer[0];
 
-        asic_.setDataRequest(false);
+        for(unsigned channel=0; channel<3; ++channel)
+        {
+            if(channels & (1 << channel))
+            {
+                LineStatistics::accumulate(&result.sum_[channel][0], line, pixels);
+                LineStatistics::maximum(&result.maximum_[channel][0], line, pixels);
+                line += pixels;
+            }
+        }
     }
 
-    fifo.closeWriteFifo();
-
+    asic_.begin();
+    asic_.setByteCount(BytePerLine);
     asic_.setCCDMode(false);
     asic_.setDMA(false);
-
+    asic_.commit();
 }
 
+void ScannerControl::scanLinesGray(A4s2600::Channel channel,
+                                   unsigned numberOfLines,
+                                   bool moveWhileScanning,
+                                   PosixFiFo &fifo,
+                                   bool enableCalibration)
+{
+    const size_t width = getImageWidth();
 
+    scanLines(channel, numberOfLines, moveWhileScanning, enableCalibration, [&fifo, width](uint8_t *line) {
+        fifo.write(line, width);
+    });
+
+    fifo.closeWriteFifo();
+}
 
 void ScannerControl::scanLinesGray(A4s2600::Channel channel,
                                    unsigned numberOfLines,
@@ -371,68 +757,217 @@ void ScannerControl::scanLinesGray(A4s2600::Channel channel,
                                    size_t bufferSize,
                                    bool enableCalibration)
 {
+    if(bufferSize < size_t(numberOfLines) * BytePerLine)
+    {
+        throw std::runtime_error("The buffer is too small for "+std::to_string(numberOfLines)+" lines");
+    }
+
+    const size_t width = getImageWidth();
+
+    scanLines(channel, numberOfLines, moveWhileScanning, enableCalibration, [&buffer, width](uint8_t *line) {
+        memcpy(buffer, line, width);
+        buffer += BytePerLine;
+    });
+}
 
+void ScannerControl::scanLines(A4s2600::Channel channel,
+                               unsigned numberOfLines,
+                               bool moveWhileScanning,
+                               bool enableCalibration,
+                               const std::function<void(uint8_t *)> &sink)
+{
     unsigned scannedLines = 0;
     unsigned readLines = 0;
+    unsigned stalledPeriods = 0;
+    size_t filled = 0;
+    Line line(BytePerLine);
+
+    const size_t transferred = getTransferredBytesPerLine();
+    const unsigned period = asic_.getCurrentExposureLevel();
+    uint64_t periodBytes = 0;
+    uint64_t busyBytes = 0;
+    unsigned busyPeriods = 0;
+    bool idle = true; //The first period is only partly seen
+
+    fifoTuning_.plan(transferred, period);
+
+    //The lower limit tells when a chunk can be read without waiting, above the upper limit the FIFO is close to overflowing
+    asic_.begin();
+    asic_.setByteCount(transferred);
     asic_.setSpeedCounter(motorSpeed_);
+    asic_.setLowerMemoryLimit(fifoTuning_.getLowerLimit());
+    asic_.setUpperMemoryLimit(fifoTuning_.getUpperLimit());
     asic_.resetFiFo();
 
     asic_.setCCDMode(true);
     asic_.setDMA(true);
+    asic_.setDataRequest(true);
+    asic_.commit();
+
+    //The ASIC does not wait for the FIFO, so it only clocks the scan if the bus keeps up with it
+    const bool asicClocked = moveWhileScanning && motorMode_ == AsicClockedMotor && fifoTuning_.keepsUp();
+    bool clockLevel = asic_.getClockLevel();
+
+    if(moveWhileScanning && motorMode_ == AsicClockedMotor && !asicClocked)
+    {
+        std::cerr<<"The bus is too slow for the ASIC clocked scan, the driver clocks the lines"<<std::endl;
+    }
 
-    while(scannedLines < numberOfLines)
+    if(asicClocked)
     {
-        do
+        //Started right after a falling edge the first rising edge the ASIC takes is the first one seen here
+        if(clockLevel)
+        {
+            asic_.waitForClockChange();
+            clockLevel = false;
+        }
+
+        asic_.setMotorDirection(A4s2600::MoveForward);
+        asic_.startFreeRunning(channel);
+    }
+
+    while(readLines < numberOfLines)
+    {
+        //One status read per round tells the clock level and both limits
+        const unsigned status = moveWhileScanning ? asic_.getStatus() : 0;
+
+        if(scannedLines < numberOfLines)
         {
             if(moveWhileScanning)
             {
-                asic_.waitForClockChange(2);
-            }
-            asic_.sendChannelData(channel);
-            if(moveWhileScanning)
-            {
-                asic_.enableMove(true);
-            }else
+                //A line is exposed and the carriage moved once per clock period, in between the FIFO is drained
+                const bool level = (status & A4s2600::StatusClock) != 0;
+
+                if(level != clockLevel)
+                {
+                    clockLevel = level;
+
+                    //Periods in which the FIFO never ran empty show how fast the bus is
+                    if(level && !idle)
+                    {
+                        busyBytes += periodBytes;
+                        ++busyPeriods;
+                    }
+
+                    if(level)
+                    {
+                        periodBytes = 0;
+                        idle = false;
+                    }
+
+                    if(level && asicClocked)
+                    {
+                        //The ASIC took the line itself on this edge, it is only counted to stop the ASIC after the last one
+                        if(status & A4s2600::StatusAboveUpperLimit)
+                        {
+                            asic_.stopFreeRunning();
+                            throw std::runtime_error("The FIFO overflowed during the ASIC clocked scan");
+                        }
+
+                        position_ += multiplyer_;
+                        ++scannedLines;
+
+                        if(scannedLines == numberOfLines)
+                        {
+                            asic_.stopFreeRunning();
+                        }
+                    }else if(level && (status & A4s2600::StatusAboveUpperLimit))
+                    {
+                        ++stalledPeriods; //The carriage waits a period, so no line is lost
+                    }else if(level)
+                    {
+                        asic_.sendChannelData(channel);
+                        asic_.enableMove(true);
+                        position_ += multiplyer_;
+                        ++scannedLines;
+                    }
+                }
+            }else if(readLines == scannedLines)
             {
+                //Without the motor there is nothing to keep in step with, one line after the other is taken
+                asic_.sendChannelData(channel);
                 asic_.waitForChannelTransferedToFiFo(channel);
+                ++scannedLines;
             }
-            ++scannedLines;
-        }while(scannedLines % 20 != 0 && scannedLines < numberOfLines);
+        }
 
-        asic_.setDataRequest(true);
+        if(readLines == scannedLines)
+        {
+            continue;
+        }
 
-        do
+        //Once everything is exposed the rest is read waiting for the data
+        size_t chunk = transferred - filled;
+
+        if(moveWhileScanning && scannedLines < numberOfLines)
         {
-            asic_.aquireImageData(buffer+BytePerLine*readLines,BytePerLine);
+            if(!(status & A4s2600::StatusAboveLowerLimit))
+            {
+                idle = true;
+                continue;
+            }
+
+            chunk = std::min(chunk, fifoTuning_.getChunk());
+        }
 
+        asic_.aquireImageData(&line[filled], chunk);
+        filled += chunk;
+        periodBytes += chunk;
+
+        if(filled == transferred)
+        {
             if(enableCalibration)
             {
-                for(unsigned int i=0; i<5300/multiplyer_; ++i)
-                {
-                    double tmp = buffer[BytePerLine*readLines + i*multiplyer_]*perPixelGain[channel][i*multiplyer_];
-                    if(tmp >= 256)
-                    {
-                        tmp = 255;
-                    }
-
-                    buffer[BytePerLine*readLines + i] = (uint8_t)tmp;
-                }
+                shading_[channel].apply(&line[windowStart_]);
             }
 
+            sink(&line[windowStart_]);
+
+            filled = 0;
             ++readLines;
-        }while(readLines != scannedLines);
+        }
+    }
 
-        asic_.setDataRequest(false);
+    if(stalledPeriods)
+    {
+        std::cerr<<"The motor waited "<<std::dec<<stalledPeriods<<" periods for the FIFO"<<std::endl;
     }
 
+    fifoTuning_.measured(busyBytes, uint64_t(busyPeriods) * period);
+
+    asic_.begin();
+    asic_.setByteCount(BytePerLine);
+    asic_.setDataRequest(false);
     asic_.setCCDMode(false);
     asic_.setDMA(false);
-
+    asic_.commit();
 }
 
 unsigned ScannerControl::getImageWidth()
 {
-    return 5300/multiplyer_;
+    return windowWidth_/multiplyer_;
+}
+
+void ScannerControl::setScanWindow(unsigned start, unsigned width)
+{
+    if(start >= CCdWidth)
+    {
+        throw std::runtime_error("The scan window starts behind the end of the CCD");
+    }
+
+    windowStart_ = start;
+    windowWidth_ = std::max(1u, std::min<unsigned>(width, CCdWidth - start));
+
+    for(ShadingCorrection &shading : shading_)
+    {
+        shading.setWindow(windowStart_, windowWidth_);
+    }
+}
+
+size_t ScannerControl::getTransferredBytesPerLine()
+{
+    //There is no known way to let the ASIC skip pixels or start later, the line can only end after the last pixel that is kept
+    return windowStart_ + size_t(std::max(1u, getImageWidth()) - 1) * multiplyer_ + 1;
 }
 
 
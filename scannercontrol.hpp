@@ -2,6 +2,10 @@
 #define SCANNERCONTROL_H
 
 #include "a4s2600.hpp"
+#include "fifotuning.hpp"
+#include "shadingcorrection.hpp"
+
+#include <functional>
 
 class PosixFiFo;
 
@@ -9,20 +13,113 @@ class ScannerControl
 {
 public:  
 
+    enum ShadingMode
+    {
+        SoftwareShading, ///< Every pixel is multiplied with its gain on the host
+        HardwareShading  ///< The gain is uploaded into the ASIC, which sends corrected data
+    };
+
+    enum MotorMode
+    {
+        HostClockedMotor, ///< The driver starts every line and step on a clock edge
+        AsicClockedMotor  ///< The ASIC starts them on its own clock and the driver only drains the FIFO, see A4s2600::startFreeRunning
+    };
+
+    /**
+     * @brief The ChannelCalibration struct holds everything calibrateScanner measures for a channel
+     */
+    struct ChannelCalibration
+    {
+        ChannelCalibration(): valid_(false), pgaGain_(0), pgaOffset_(0), digitalOffset_(0) {}
+
+        bool valid_;
+        unsigned pgaGain_;
+        unsigned pgaOffset_;
+        unsigned digitalOffset_;
+        std::vector<uint8_t> white_; ///< Maximum of the white strip per pixel
+        std::vector<uint8_t> dark_;  ///< Average per pixel with the lamp off
+    };
+
+    struct Calibration
+    {
+        ChannelCalibration channels_[3];
+    };
+
     ScannerControl(A4s2600 &asic);
 
+    /**
+     * @brief setShadingMode selects where the pixel gain is applied, takes effect with the next calibration
+     */
+    void setShadingMode(ShadingMode mode) { shadingMode_ = mode; }
+    ShadingMode getShadingMode() const { return shadingMode_; }
+
+    /**
+     * @brief setMotorMode selects who clocks the lines while the carriage moves during a scan
+     */
+    void setMotorMode(MotorMode mode) { motorMode_ = mode; }
+    MotorMode getMotorMode() const { return motorMode_; }
+
+    /**
+     * @brief getFifoTuning gives access to the bus throughput the FIFO limits are worked out from for every scan
+     */
+    FifoTuning &getFifoTuning() { return fifoTuning_; }
+
+    /**
+     * @brief gotoHomePos searches the home sensor and resets the carriage position, a known position is approached quickly
+     */
     void gotoHomePos();
+
+    /**
+     * @brief moveToCalibrationPosition moves the carriage back onto the white strip, by counting steps as long as
+     * the position is known and by searching the home sensor every few returns
+     */
+    void moveToCalibrationPosition();
     void setupResolution(unsigned dpi);
     void scanLinesGray(A4s2600::Channel channel, unsigned numberOfLines, bool moveWhileScanning, uint8_t *buffer, size_t bufferSize, bool enableCalibration = false);
     void scanLinesGray(A4s2600::Channel channel, unsigned numberOfLines, bool moveWhileScanning, PosixFiFo &fifo, bool enableCalibration = false);
     void calibrateScanner();
-    void moveToStartPosition();
+
+    const Calibration &getCalibration() const { return calibration_; }
+
+    /**
+     * @brief applyCalibration restores the result of an earlier calibrateScanner(), e.g. from a CalibrationCache.
+     * Throws if the white or dark line of a valid channel does not cover the CCD.
+     */
+    void applyCalibration(const Calibration &calibration);
+
+    /**
+     * @brief verifyCalibration scans one line of the white strip and checks that the white and black level
+     * did not drift more than tolerance from what they were during the calibration
+     */
+    bool verifyCalibration(unsigned tolerance);
+    /**
+     * @brief moveToStartPosition moves the carriage to topInCm below the top of the scan area
+     */
+    void moveToStartPosition(double topInCm = 0);
+
+    /**
+     * @brief getPosition returns the carriage position in 600dpi lines from the home position
+     */
+    unsigned getPosition() const { return position_; }
     unsigned getNumberOfLines(double sizeInCm);
     unsigned getImageWidth();
 
+    /**
+     * @brief setScanWindow selects the columns of the CCD that are scanned, in 600dpi pixels. The ASIC stops every
+     * line after the window, the pixels in front of it are still transferred but not processed.
+     */
+    void setScanWindow(unsigned start, unsigned width);
+    unsigned getScanWindowStart() const { return windowStart_; }
+    unsigned getScanWindowWidth() const { return windowWidth_; }
+
     static void switchToScanner(ParallelPortBase &pb);
     static void switchToPrinter(ParallelPortBase &pb);
 
+    /**
+     * @brief getCcdWidth returns the number of pixels of a line, the size of the white and dark line of a calibration
+     */
+    static unsigned getCcdWidth();
+
     int getDpi();
 
 private:
@@ -30,15 +127,69 @@ private:
     A4s2600 &asic_;
     unsigned motorSpeed_;
     unsigned multiplyer_;
-    double perPixelGain[3][5300];
+    unsigned position_;
+    bool homed_;                  ///< position_ is known since the home sensor was found
+    unsigned returnsSinceHoming_; ///< Counted moves back since the last search for the home sensor
+    std::vector<unsigned> moveSpeed_; ///< Speed counter of positioning steps, indexed by the step length in lines - 1
+    unsigned windowStart_;
+    unsigned windowWidth_;
+    ShadingMode shadingMode_;
+    MotorMode motorMode_;
+    Calibration calibration_;
+    ShadingCorrection shading_[3]; ///< Dark level, the gain not applied by the ASIC and decimation per channel
+    FifoTuning fifoTuning_;
+
+    /**
+     * @brief The Measurement struct holds what measure() found for every channel
+     */
+    struct Measurement
+    {
+        std::vector<uint16_t> sum_[3]; ///< Sum of every pixel over all exposures
+        Line maximum_[3];              ///< Maximum of every pixel
+    };
 
     void initalSetupScanner();
-    void adjustAnalogGain(A4s2600::Channel channel);
-    void adjustOffset(A4s2600::Channel channel);
-    unsigned adjustAnalogOffset(A4s2600::Channel channel);
-    unsigned getBlackTotal(const Line &line);
-    unsigned getBrightSum(const Line &line);
-    void compensatePixelNonuniformity(A4s2600::Channel channel);
+
+    /**
+     * @brief moveTo moves the carriage to a line, the steps are counted instead of timed
+     */
+    void moveTo(unsigned line);
+
+    /**
+     * @brief planMove splits a distance into steps that speed up one line at a time, cruise at MaxMoveLines
+     * and slow down again, so the motor never has to jump between speeds
+     */
+    void planMove(unsigned distance, std::vector<unsigned> &steps);
+
+    /* The calibration steps work on a bit mask of channels (1 << A4s2600::Channel) and share the measurements */
+    void adjustAnalogGain(unsigned channels);
+    void adjustOffset(unsigned channels);
+    void adjustAnalogOffset(unsigned channels, unsigned offset[3]);
+    void measureBrightness(unsigned channels, const unsigned gain[3], double brightness[3]);
+    void compensatePixelNonuniformity(unsigned channels);
+
+    /**
+     * @brief waitForLamp gives the lamp time to settle after it was switched
+     */
+    void waitForLamp(unsigned ms);
+
+    /**
+     * @brief measure exposes the channels a few times on the spot, every exposure is read out for all channels
+     * and only the first pixels of every line are transferred
+     */
+    void measure(unsigned channels, size_t pixels, unsigned exposures, Measurement &result);
+
+    /**
+     * @brief scanLines exposes the lines and drains the FIFO at the same time, every complete line is passed to sink
+     */
+    void scanLines(A4s2600::Channel channel, unsigned numberOfLines, bool moveWhileScanning, bool enableCalibration,
+                   const std::function<void(uint8_t *line)> &sink);
+    void updateShading(A4s2600::Channel channel);
+
+    /**
+     * @brief getTransferredBytesPerLine returns how many bytes of a line the ASIC sends while scanning
+     */
+    size_t getTransferredBytesPerLine();
 };
 
 #endif // SCANNERCONTROL_H
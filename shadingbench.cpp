@@ -0,0 +1,149 @@
+#include "shadingcorrection.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Measures the shading correction of a 600dpi line for every resolution:
+ *
+ *   shadingbench [lines]
+ *
+ * "double" is the per pixel double multiply ScannerControl used before (without dark level), the
+ * others are the ShadingCorrection kernels including the dark level. Every kernel is checked against
+ * the scalar one first.
+ */
+
+enum
+{
+    CcdWidth = 5300
+};
+
+typedef std::chrono::duration<double, std::nano> NsDuration;
+
+static void fillLine(std::vector<uint8_t> &line, unsigned seed)
+{
+    for(size_t i=0; i<line.size(); ++i)
+    {
+        line[i] = (i * 7 + seed * 13) & 0xFF;
+    }
+}
+
+static double measureDouble(const std::vector<double> &gain, unsigned factor, unsigned lines)
+{
+    std::vector<uint8_t> line(CcdWidth);
+    NsDuration total(0);
+
+    for(unsigned n=0; n<lines; ++n)
+    {
+        fillLine(line, n);
+        auto start = std::chrono::steady_clock::now();
+
+        for(unsigned int i=0; i<CcdWidth/factor; ++i)
+        {
+            double tmp = line[i*factor]*gain[i*factor];
+            if(tmp >= 256)
+            {
+                tmp = 255;
+            }
+
+            line[i] = (uint8_t)tmp;
+        }
+
+        total += std::chrono::steady_clock::now() - start;
+    }
+
+    return total.count() / lines;
+}
+
+static double measureKernel(const ShadingCorrection &shading, unsigned lines)
+{
+    std::vector<uint8_t> line(CcdWidth);
+    NsDuration total(0);
+
+    for(unsigned n=0; n<lines; ++n)
+    {
+        fillLine(line, n);
+        auto start = std::chrono::steady_clock::now();
+        shading.apply(&line[0]);
+        total += std::chrono::steady_clock::now() - start;
+    }
+
+    return total.count() / lines;
+}
+
+static bool matchesScalar(ShadingCorrection shading)
+{
+    std::vector<uint8_t> expected(CcdWidth);
+    std::vector<uint8_t> result(CcdWidth);
+
+    for(unsigned n=0; n<256; ++n)
+    {
+        fillLine(result, n);
+        expected = result;
+
+        shading.apply(&result[0]);
+
+        ShadingCorrection scalar(shading);
+        scalar.setKernel(ShadingCorrection::Scalar);
+        scalar.apply(&expected[0]);
+
+        if(!std::equal(expected.begin(), expected.begin() + shading.getOutputSize(), result.begin()))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const unsigned lines = argc > 1 ? std::stoul(argv[1]) : 20000;
+    static const unsigned factors[] = {1, 2, 3, 6, 12};
+
+    std::vector<double> gain(CcdWidth);
+    std::vector<uint8_t> dark(CcdWidth);
+
+    for(size_t i=0; i<gain.size(); ++i)
+    {
+        gain[i] = 1.0 + (i % 97) / 97.0;
+        dark[i] = i % 11;
+    }
+
+    std::cout<<"ns per line ("<<lines<<" lines)"<<std::endl;
+
+    for(unsigned factor : factors)
+    {
+        ShadingCorrection shading;
+        shading.setGain(gain);
+        shading.setDark(dark);
+        shading.setDecimation(factor);
+
+        std::cout<<600 / factor<<"dpi: double "<<measureDouble(gain, factor, lines);
+
+        for(unsigned kernel=0; kernel<ShadingCorrection::KernelCount; ++kernel)
+        {
+            if(!ShadingCorrection::isSupported(ShadingCorrection::Kernel(kernel)))
+            {
+                continue;
+            }
+
+            shading.setKernel(ShadingCorrection::Kernel(kernel));
+
+            if(!matchesScalar(shading))
+            {
+                std::cerr<<std::endl<<ShadingCorrection::getName(shading.getKernel())<<" does not match the scalar kernel"<<std::endl;
+                return -1;
+            }
+
+            std::cout<<", "<<ShadingCorrection::getName(shading.getKernel())<<" "<<measureKernel(shading, lines);
+        }
+
+        std::cout<<std::endl;
+    }
+
+    return 0;
+}
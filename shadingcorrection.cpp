@@ -0,0 +1,328 @@
+#include "shadingcorrection.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHADING_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*KernelFunction)(uint8_t *line, const uint8_t *dark, const uint16_t *gain, size_t count, unsigned factor);
+
+static inline uint8_t correctPixel(uint8_t pixel, uint8_t dark, uint16_t gain)
+{
+    const unsigned value = (unsigned(pixel > dark ? pixel - dark : 0) * gain) >> ShadingCorrection::GainShift;
+
+    return value > 0xFF ? 0xFF : value;
+}
+
+/**
+ * SSE2 has no byte shuffle, so its kernel only handles the factors 1 and 2 directly. The AVX2 kernel
+ * gathers the pixels of factors up to 16 with shuffles. Any other factor first moves the kept pixels
+ * to the front (a forward copy, the destination never overtakes the source) and runs with factor 1.
+ */
+static void compact(uint8_t *line, size_t count, unsigned factor)
+{
+    for(size_t i=1; i<count; ++i)
+    {
+        line[i] = line[i*factor];
+    }
+}
+
+static void correctScalar(uint8_t *line, const uint8_t *dark, const uint16_t *gain, size_t count, unsigned factor)
+{
+    for(size_t i=0; i<count; ++i)
+    {
+        line[i] = correctPixel(line[i*factor], dark[i], gain[i]);
+    }
+}
+
+#ifdef SHADING_X86
+
+/*
+ * The pixels and dark levels are widened to 16 bit, the subtraction saturates at 0. Shifted left by 2
+ * and multiplied with the gain, the high 16 bit of the product are (pixel - dark) * gain >> 14.
+ */
+
+__attribute__((target("sse2")))
+static void correctSse2(uint8_t *line, const uint8_t *dark, const uint16_t *gain, size_t count, unsigned factor)
+{
+    if(factor > 2)
+    {
+        compact(line, count, factor);
+        factor = 1;
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    size_t i = 0;
+
+    for(; i + 16 <= count; i += 16)
+    {
+        __m128i low;
+        __m128i high;
+
+        if(factor == 1)
+        {
+            const __m128i pixels = _mm_loadu_si128((const __m128i*)(line + i));
+
+            low = _mm_unpacklo_epi8(pixels, zero);
+            high = _mm_unpackhi_epi8(pixels, zero);
+        }else
+        {
+            //The even bytes are the kept pixels, as 16 bit lanes they only need the odd bytes masked
+            low = _mm_and_si128(_mm_loadu_si128((const __m128i*)(line + 2 * i)), lowBytes);
+            high = _mm_and_si128(_mm_loadu_si128((const __m128i*)(line + 2 * i + 16)), lowBytes);
+        }
+
+        const __m128i darkLevel = _mm_loadu_si128((const __m128i*)(dark + i));
+
+        low = _mm_subs_epu16(low, _mm_unpacklo_epi8(darkLevel, zero));
+        high = _mm_subs_epu16(high, _mm_unpackhi_epi8(darkLevel, zero));
+
+        low = _mm_mulhi_epu16(_mm_slli_epi16(low, 16 - ShadingCorrection::GainShift), _mm_loadu_si128((const __m128i*)(gain + i)));
+        high = _mm_mulhi_epu16(_mm_slli_epi16(high, 16 - ShadingCorrection::GainShift), _mm_loadu_si128((const __m128i*)(gain + i + 8)));
+
+        _mm_storeu_si128((__m128i*)(line + i), _mm_packus_epi16(low, high));
+    }
+
+    for(; i<count; ++i)
+    {
+        line[i] = correctPixel(line[i*factor], dark[i], gain[i]);
+    }
+}
+
+/*
+ * 16 kept pixels of a factor above 2 lie in factor blocks of 16 bytes, two blocks are loaded at once.
+ * Every block is shuffled with its own mask, which moves the kept pixels in it to their place and
+ * zeroes the other bytes. The two halves are combined at the end.
+ */
+
+enum
+{
+    MaxGatherFactor = 16,
+    GatherLoads = (MaxGatherFactor + 1) / 2
+};
+
+__attribute__((target("avx2")))
+static void buildGatherMasks(__m256i *masks, unsigned factor)
+{
+    for(unsigned load=0; load<(factor + 1) / 2; ++load)
+    {
+        alignas(32) int8_t mask[32];
+
+        for(unsigned byte=0; byte<32; ++byte)
+        {
+            const unsigned block = 2 * load + byte / 16;
+            const unsigned offset = (byte % 16) * factor - 16 * block;
+
+            mask[byte] = offset < 16 ? int8_t(offset) : int8_t(0x80);
+        }
+
+        masks[load] = _mm256_load_si256((const __m256i*)mask);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m128i gatherPixels(const uint8_t *line, const __m256i *masks, unsigned factor)
+{
+    __m256i pixels = _mm256_setzero_si256();
+
+    for(unsigned load=0; load<(factor + 1) / 2; ++load)
+    {
+        pixels = _mm256_or_si256(pixels, _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(line + 32 * load)), masks[load]));
+    }
+
+    return _mm_or_si128(_mm256_castsi256_si128(pixels), _mm256_extracti128_si256(pixels, 1));
+}
+
+__attribute__((target("avx2")))
+static void correctAvx2(uint8_t *line, const uint8_t *dark, const uint16_t *gain, size_t count, unsigned factor)
+{
+    if(factor > MaxGatherFactor)
+    {
+        compact(line, count, factor);
+        factor = 1;
+    }
+
+    const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+    __m256i masks[GatherLoads];
+    size_t i = 0;
+
+    //The loads of a gather go past its last pixel, they have to stay inside the line up to the last kept pixel
+    const size_t lineEnd = count ? (count - 1) * factor + 1 : 0;
+    const size_t reach = factor > 2 ? 16 * factor + 32 * ((factor + 1) / 2) : 32 * factor;
+
+    if(factor > 2)
+    {
+        buildGatherMasks(masks, factor);
+    }
+
+    for(; i + 32 <= count && i * factor + reach <= lineEnd; i += 32)
+    {
+        __m256i low;
+        __m256i high;
+
+        if(factor == 1)
+        {
+            low = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(line + i)));
+            high = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(line + i + 16)));
+        }else if(factor > 2)
+        {
+            low = _mm256_cvtepu8_epi16(gatherPixels(line + i * factor, masks, factor));
+            high = _mm256_cvtepu8_epi16(gatherPixels(line + (i + 16) * factor, masks, factor));
+        }else
+        {
+            low = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(line + 2 * i)), lowBytes);
+            high = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(line + 2 * i + 32)), lowBytes);
+        }
+
+        low = _mm256_subs_epu16(low, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(dark + i))));
+        high = _mm256_subs_epu16(high, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(dark + i + 16))));
+
+        low = _mm256_mulhi_epu16(_mm256_slli_epi16(low, 16 - ShadingCorrection::GainShift), _mm256_loadu_si256((const __m256i*)(gain + i)));
+        high = _mm256_mulhi_epu16(_mm256_slli_epi16(high, 16 - ShadingCorrection::GainShift), _mm256_loadu_si256((const __m256i*)(gain + i + 16)));
+
+        //The pack works per 128 bit lane, the permute puts the quarters back into order
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xD8);
+
+        _mm256_storeu_si256((__m256i*)(line + i), packed);
+    }
+
+    for(; i<count; ++i)
+    {
+        line[i] = correctPixel(line[i*factor], dark[i], gain[i]);
+    }
+}
+
+#endif
+
+static const KernelFunction kernelFunctions[ShadingCorrection::KernelCount] =
+{
+    correctScalar,
+#ifdef SHADING_X86
+    correctSse2,
+    correctAvx2
+#else
+    correctScalar,
+    correctScalar
+#endif
+};
+
+ShadingCorrection::ShadingCorrection():
+    factor_(1),
+    start_(0),
+    width_(0),
+    kernel_(getBestKernel())
+{
+}
+
+void ShadingCorrection::setGain(const std::vector<double> &gain)
+{
+    gain_.resize(gain.size());
+
+    //Rounded up, otherwise a white pixel times its gain of 255/white ends up at 254
+    for(size_t i=0; i<gain.size(); ++i)
+    {
+        const double fixed = ceil(gain[i] * GainOne);
+
+        gain_[i] = fixed >= 0xFFFF ? 0xFFFF : (fixed <= 0 ? 0 : uint16_t(fixed));
+    }
+
+    dark_.resize(gain_.size(), 0);
+    updateDecimated();
+}
+
+void ShadingCorrection::setDark(const std::vector<uint8_t> &dark)
+{
+    if(dark.size() != gain_.size())
+    {
+        throw std::runtime_error("The dark level does not match the gain");
+    }
+
+    dark_ = dark;
+    updateDecimated();
+}
+
+void ShadingCorrection::setDecimation(unsigned factor)
+{
+    if(factor == 0)
+    {
+        throw std::runtime_error("Invalid decimation factor");
+    }
+
+    factor_ = factor;
+    updateDecimated();
+}
+
+void ShadingCorrection::setWindow(size_t start, size_t width)
+{
+    start_ = start;
+    width_ = width;
+    updateDecimated();
+}
+
+void ShadingCorrection::updateDecimated()
+{
+    const size_t width = width_ ? std::min(width_, getInputSize()) : getInputSize();
+
+    decimated_.resize(width / factor_);
+    decimatedDark_.resize(decimated_.size());
+
+    for(size_t i=0; i<decimated_.size(); ++i)
+    {
+        decimated_[i] = gain_[start_ + i * factor_];
+        decimatedDark_[i] = dark_[start_ + i * factor_];
+    }
+}
+
+void ShadingCorrection::apply(uint8_t *line) const
+{
+    if(!decimated_.empty())
+    {
+        kernelFunctions[kernel_](line, &decimatedDark_[0], &decimated_[0], decimated_.size(), factor_);
+    }
+}
+
+void ShadingCorrection::setKernel(Kernel kernel)
+{
+    if(!isSupported(kernel))
+    {
+        throw std::runtime_error(std::string("Shading kernel not supported: ") + getName(kernel));
+    }
+
+    kernel_ = kernel;
+}
+
+bool ShadingCorrection::isSupported(Kernel kernel)
+{
+    switch(kernel)
+    {
+    case Scalar: return true;
+#ifdef SHADING_X86
+    case Sse2: return __builtin_cpu_supports("sse2");
+    case Avx2: return __builtin_cpu_supports("avx2");
+#endif
+    default: return false;
+    }
+}
+
+ShadingCorrection::Kernel ShadingCorrection::getBestKernel()
+{
+    static const Kernel best = isSupported(Avx2) ? Avx2 : (isSupported(Sse2) ? Sse2 : Scalar);
+
+    return best;
+}
+
+const char *ShadingCorrection::getName(Kernel kernel)
+{
+    switch(kernel)
+    {
+    case Scalar: return "scalar";
+    case Sse2: return "sse2";
+    case Avx2: return "avx2";
+    default: return "unknown";
+    }
+}
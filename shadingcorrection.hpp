@@ -0,0 +1,91 @@
+#ifndef SHADINGCORRECTION_H
+#define SHADINGCORRECTION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+
+/**
+ * @brief The ShadingCorrection class subtracts the dark level of every pixel of a line, multiplies the result
+ * with the gain of the pixel and decimates the line to the scan resolution, all in the same pass.
+ *
+ * The gain is held as 16 bit fixed point with 14 fractional bits (GainOne is a gain of 1), already
+ * decimated, so a kernel reads the gain table linearly for every resolution. The result is saturated to 255.
+ * There are SSE2 and AVX2 kernels next to the scalar reference, the best one the CPU supports is
+ * selected at runtime. The AVX2 kernel works on the kept pixels directly for every factor up to 16. SSE2 has
+ * no byte shuffle, so for factors above 2 its kernel first copies the kept pixels together, one at a time.
+ */
+class ShadingCorrection
+{
+public:
+    enum
+    {
+        GainShift = 14,
+        GainOne = 1 << GainShift
+    };
+
+    enum Kernel
+    {
+        Scalar,
+        Sse2,
+        Avx2,
+        KernelCount
+    };
+
+    ShadingCorrection();
+
+    /**
+     * @brief setGain sets the gain of every pixel of the CCD, gains above 4 are clamped
+     */
+    void setGain(const std::vector<double> &gain);
+
+    /**
+     * @brief setDark sets the dark level of every pixel of the CCD, it has to match the size of the gain.
+     * The dark level is zero until it is set.
+     */
+    void setDark(const std::vector<uint8_t> &dark);
+
+    /**
+     * @brief setDecimation only keeps every factor-th pixel of a line, e.g. 2 for 300dpi
+     */
+    void setDecimation(unsigned factor);
+    unsigned getDecimation() const { return factor_; }
+
+    /**
+     * @brief setWindow limits the correction to width pixels of the CCD from start on, a width of 0 is the rest of the line
+     */
+    void setWindow(size_t start, size_t width);
+
+    size_t getInputSize() const { return gain_.size() - std::min(start_, gain_.size()); }
+    size_t getOutputSize() const { return decimated_.size(); }
+
+    /**
+     * @brief apply corrects a line in place, line points to the first pixel of the window. It reads the pixels
+     * of the window and writes the first getOutputSize()
+     *
+     * The result is (pixel - dark) * gain, a pixel below its dark level ends up as 0.
+     */
+    void apply(uint8_t *line) const;
+
+    Kernel getKernel() const { return kernel_; }
+    void setKernel(Kernel kernel);
+
+    static bool isSupported(Kernel kernel);
+    static Kernel getBestKernel();
+    static const char *getName(Kernel kernel);
+
+private:
+    std::vector<uint16_t> gain_;      ///< Gain of every CCD pixel
+    std::vector<uint16_t> decimated_; ///< Gain of every pixel that is kept
+    std::vector<uint8_t> dark_;       ///< Dark level of every CCD pixel
+    std::vector<uint8_t> decimatedDark_;
+    unsigned factor_;
+    size_t start_;
+    size_t width_;
+    Kernel kernel_;
+
+    void updateDecimated();
+};
+
+#endif // SHADINGCORRECTION_H
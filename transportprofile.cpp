@@ -0,0 +1,199 @@
+#include "transportprofile.hpp"
+
+#include <fstream>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static std::string trim(const std::string &text)
+{
+    const char *whitespace = " \t\r\n";
+    size_t start = text.find_first_not_of(whitespace);
+
+    if(start == std::string::npos)
+    {
+        return std::string();
+    }
+
+    return text.substr(start, text.find_last_not_of(whitespace) - start + 1);
+}
+
+TransportProfile::TransportProfile()
+{
+}
+
+bool TransportProfile::load(const std::string &filename)
+{
+    std::ifstream file(filename);
+
+    if(!file.is_open())
+    {
+        return false;
+    }
+
+    const std::string host = hostName();
+    std::map<std::string, std::string> hostValues;
+    std::string section;
+    std::string line;
+
+    while(std::getline(file, line))
+    {
+        line = trim(line.substr(0, line.find('#')));
+
+        if(line.empty())
+        {
+            continue;
+        }
+
+        if(line[0] == '[' && line[line.size()-1] == ']')
+        {
+            section = trim(line.substr(1, line.size()-2));
+            continue;
+        }
+
+        size_t separator = line.find('=');
+
+        if(separator == std::string::npos)
+        {
+            continue;
+        }
+
+        const std::string key = trim(line.substr(0, separator));
+        const std::string value = trim(line.substr(separator+1));
+
+        if(section == "default")
+        {
+            values_[key] = value;
+        }else if(section == host)
+        {
+            hostValues[key] = value;
+        }
+    }
+
+    //The host section wins, no matter where in the file it is
+    for(const auto &entry : hostValues)
+    {
+        values_[entry.first] = entry.second;
+    }
+
+    return true;
+}
+
+bool TransportProfile::save(const std::string &filename) const
+{
+    if(filename.empty())
+    {
+        return false;
+    }
+
+    //Written next to the profile and renamed, so a concurrent reader never sees half a file
+    const std::string temporary = filename + ".tmp";
+
+    {
+        std::ofstream file(temporary);
+
+        if(!file.is_open())
+        {
+            return false;
+        }
+
+        file<<"# Measured by the se12000p driver, rewritten after every scan\n";
+        file<<"[default]\n";
+
+        for(const auto &entry : values_)
+        {
+            file<<entry.first<<" = "<<entry.second<<"\n";
+        }
+
+        file.close();
+
+        if(file.fail())
+        {
+            remove(temporary.c_str());
+            return false;
+        }
+    }
+
+    return rename(temporary.c_str(), filename.c_str()) == 0;
+}
+
+bool TransportProfile::has(const std::string &key) const
+{
+    return values_.find(key) != values_.end();
+}
+
+unsigned TransportProfile::get(const std::string &key, unsigned defaultValue) const
+{
+    auto entry = values_.find(key);
+
+    if(entry == values_.end())
+    {
+        return defaultValue;
+    }
+
+    try
+    {
+        return std::stoul(entry->second, nullptr, 0);
+    }catch(const std::exception &)
+    {
+        return defaultValue;
+    }
+}
+
+void TransportProfile::set(const std::string &key, unsigned value)
+{
+    values_[key] = std::to_string(value);
+}
+
+std::string TransportProfile::defaultFilename()
+{
+    const char *filename = getenv("SANE_SE12000P_PROFILE");
+
+    if(filename)
+    {
+        return filename;
+    }
+
+    return "/etc/sane.d/se12000p.conf";
+}
+
+std::string TransportProfile::tunedFilename()
+{
+    const char *filename = getenv("SANE_SE12000P_TUNING");
+
+    if(filename)
+    {
+        return filename;
+    }
+
+    const char *cache = getenv("XDG_CACHE_HOME");
+
+    if(cache)
+    {
+        return std::string(cache) + "/se12000p-tuning";
+    }
+
+    const char *home = getenv("HOME");
+
+    if(!home)
+    {
+        const struct passwd *user = getpwuid(getuid());
+
+        home = user ? user->pw_dir : nullptr;
+    }
+
+    return home ? std::string(home) + "/.cache/se12000p-tuning" : std::string();
+}
+
+std::string TransportProfile::hostName()
+{
+    char name[256] = {0};
+
+    if(gethostname(name, sizeof(name)-1) != 0)
+    {
+        return std::string();
+    }
+
+    return name;
+}
@@ -0,0 +1,49 @@
+#ifndef TRANSPORTPROFILE_H
+#define TRANSPORTPROFILE_H
+
+#include <map>
+#include <string>
+
+/**
+ * @brief The TransportProfile class holds the per host settings of the parallel port transport.
+ *
+ * The profile file is a simple ini like file. Values of the [default] section are read first and
+ * are overwritten by the values of the section named like the host:
+ *
+ *   # Delays are given in ns
+ *   [default]
+ *   address_strobe = 4000
+ *
+ *   [scanhost]
+ *   address_strobe = 1500
+ */
+class TransportProfile
+{
+public:
+    TransportProfile();
+
+    bool load(const std::string &filename);
+
+    /**
+     * @brief save writes all values into the [default] section of filename, comments and other hosts are not kept
+     */
+    bool save(const std::string &filename) const;
+
+    bool has(const std::string &key) const;
+    unsigned get(const std::string &key, unsigned defaultValue) const;
+    void set(const std::string &key, unsigned value);
+
+    static std::string defaultFilename();
+
+    /**
+     * @brief tunedFilename returns the per user profile the driver keeps the values it measured in, it is read on top of the
+     * default profile. Empty if the user has no home.
+     */
+    static std::string tunedFilename();
+    static std::string hostName();
+
+private:
+    std::map<std::string, std::string> values_;
+};
+
+#endif // TRANSPORTPROFILE_H
@@ -1,52 +1,96 @@
 #include "wm8144.hpp"
 #include "a4s2600.hpp"
 
+#include <algorithm>
+
 Wm8144::Wm8144(A4s2600 &asic):
     asic_(asic)
 {
+    invalidateRegisterCache();
+}
+
+void Wm8144::invalidateRegisterCache()
+{
+    std::fill(registers_, registers_ + RegisterCount, int(UnknownValue));
+}
+
+void Wm8144::writeRegister(unsigned reg, unsigned value)
+{
+    //The ASIC only passes these address bits on (see A4s2600::writeToWMRegister)
+    const unsigned address = reg & 0x2F;
+
+    value &= 0xFF;
+
+    if(registers_[address] == int(value))
+    {
+        return;
+    }
+
+    asic_.writeToWMRegister(address, value);
+
+    //The per channel registers have a fourth address that writes all three channels
+    if(address >= 0x20 && (address & 0x3) == 0x3)
+    {
+        registers_[address & ~0x3] = value;
+        registers_[(address & ~0x3) | 1] = value;
+        registers_[(address & ~0x3) | 2] = value;
+    }else if(address >= 0x20)
+    {
+        //The broadcast register does not reflect the single channels any more
+        registers_[address | 0x3] = UnknownValue;
+    }
+
+    registers_[address] = value;
 }
 
 void Wm8144::setOperationalMode(OperationalMode mode)
 {
+    //One transaction, so the serial interface is enabled once for all writes
+    asic_.begin();
+
     if(mode == Color)
     {
-        asic_.writeToWMRegister(0x1, 0x1B); // ENADC, CDS, DEFPG, DEFPO
-        asic_.writeToWMRegister(0x2, 0x04); // INVOP
-        asic_.writeToWMRegister(0x3, 0xE2); // RLC = 2 (Clamp at 3.5V), CHAN= 3 (Monochrom channel dont care), CDSREF=2 (-1 Clk), PWP=0
-        asic_.writeToWMRegister(0x5, 0x10); // Mode12
-        asic_.writeToWMRegister(0x2B, 0x02);// ALL PGA Gains = 2
-        asic_.writeToWMRegister(0x27, 0x00);// DAC Sign = "+"
+        writeRegister(0x1, 0x1B); // ENADC, CDS, DEFPG, DEFPO
+        writeRegister(0x2, 0x04); // INVOP
+        writeRegister(0x3, 0xE2); // RLC = 2 (Clamp at 3.5V), CHAN= 3 (Monochrom channel dont care), CDSREF=2 (-1 Clk), PWP=0
+        writeRegister(0x5, 0x10); // Mode12
+        writeRegister(0x2B, 0x02);// ALL PGA Gains = 2
+        writeRegister(0x27, 0x00);// DAC Sign = "+"
     }else
     {
-        asic_.writeToWMRegister(0x1, 0x1F); // ENADC, CDS, DEFPG, DEFPO, MONO
-        asic_.writeToWMRegister(0x2, 0x04); // INVOP
-        asic_.writeToWMRegister(0x3, 0x62); // RLC = 2 (Clamp at 3.5V), CHAN= 01 (Green), CDSREF=2 (-1 Clk), PWP=0
-        asic_.writeToWMRegister(0x5, 0x10); // Mode12
-        asic_.writeToWMRegister(0x2B, 0x02);// ALL PGA Gains = 2
-        asic_.writeToWMRegister(0x27, 0x00);// DAC Sign = "+"
+        writeRegister(0x1, 0x1F); // ENADC, CDS, DEFPG, DEFPO, MONO
+        writeRegister(0x2, 0x04); // INVOP
+        writeRegister(0x3, 0x62); // RLC = 2 (Clamp at 3.5V), CHAN= 01 (Green), CDSREF=2 (-1 Clk), PWP=0
+        writeRegister(0x5, 0x10); // Mode12
+        writeRegister(0x2B, 0x02);// ALL PGA Gains = 2
+        writeRegister(0x27, 0x00);// DAC Sign = "+"
     }
+
+    asic_.commit();
 }
 
 void Wm8144::setPGAGain(ColorChannels channel, unsigned gain)
 {
-    asic_.writeToWMRegister(0b101000 | channel, gain & 0x1F);
+    writeRegister(0b101000 | channel, gain & 0x1F);
 }
 
 void Wm8144::setPGAOffset(ColorChannels channel, int offset)
 {
     const unsigned poffset = abs(offset);
 
-    asic_.writeToWMRegister(0b100000 | channel, poffset & 0xFF);
-    /*asic_.writeToWMRegister(0b100100 | channel, offset > 0? 0:1);*/
+    writeRegister(0b100000 | channel, poffset & 0xFF);
+    /*writeRegister(0b100100 | channel, offset > 0? 0:1);*/
 }
 
 void Wm8144::setPixelOffset(ColorChannels channel, unsigned offset)
 {
-    asic_.writeToWMRegister(0b101100 | channel, offset & 0x3F);
+    writeRegister(0b101100 | channel, offset & 0x3F);
 }
 
 void Wm8144::setPixelGain(ColorChannels channel, unsigned gain)
 {
-    asic_.writeToWMRegister(0b110000 | channel, (gain >>4)& 0xFF);
-    asic_.writeToWMRegister(0b110100 | channel, gain & 0x0F);
+    asic_.begin();
+    writeRegister(0b110000 | channel, (gain >>4)& 0xFF);
+    writeRegister(0b110100 | channel, gain & 0x0F);
+    asic_.commit();
 }
@@ -30,9 +30,23 @@ public:
     void setPixelOffset(ColorChannels channel, unsigned offset);
     void setPixelGain(ColorChannels channel, unsigned gain);
 
+    /**
+     * @brief invalidateRegisterCache forgets what the WM8144 registers contain, the next write of every
+     * register goes out even if the value did not change.
+     */
+    void invalidateRegisterCache();
 
 private:
+    enum
+    {
+        RegisterCount = 64,
+        UnknownValue = -1
+    };
+
     A4s2600 &asic_;
+    int registers_[RegisterCount]; ///< Last value written to each register
+
+    void writeRegister(unsigned reg, unsigned value);
 
 };
 